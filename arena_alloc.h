@@ -9,14 +9,152 @@
     basically trading semantic purity for performance. Calling the destructor releases all blocks.
 
     In this implementation, dynamic growth is handled by creating new blocks (in some implementations,
-    this is instead handled by creating a larger block and copying the data over). These new blocks
-    are inserted after the current block, which means that if there are already existing blocks after
-    the current block (because reset() was called), a memory leak results, which must be managed by
-    calling free() eventually. This is done to keep block creation simple (avoiding looking for
-    existing blocks).
+    this is instead handled by creating a larger block and copying the data over). After reset(), the
+    blocks past the current one are still in the chain, so growth first advances into the next block if
+    it's big enough for the allocation. Blocks that are too small are unlinked into a cache of spare
+    blocks, which is searched (first fit) before a new block is created. This way, an arena that sees the
+    same allocation pattern every cycle does no mallocs at all after the first cycle. The cache is
+    released by free() and the destructor. capacity() returns how much the chain and the cache hold together.
 
     This implementation supports packing all of the data into a contiguous buffer. To make packing more efficient,
     the total size is tracked across allocations, which, of course, adds overhead.
+
+    When the data is only being packed to be written out, the copy can be skipped entirely with pack_iovec(),
+    which describes the used part of each block as an iovec (in the same order as pack()), ready to be passed
+    to writev()/pwritev() or an io_uring write. Like snprintf(), it returns the number of entries needed,
+    filling in at most max_count of them, so it can be called with a null array first to size it. Note that
+    writev() accepts at most IOV_MAX entries per call.
+
+    When the data is only being packed to be hashed, compressed or sent somewhere, pack_to(writer, chunk_size)
+    streams it to a callback instead, in pack() order and in pieces of at most chunk_size bytes, so exporting
+    an arena never needs a second copy of it. The writer is called as writer(data, size) and returns false to
+    stop early. Pieces point straight into the blocks, except when relocations are recorded (see below), in
+    which case each piece is staged in a chunk_size buffer so the recomputed distances can be patched in.
+
+    For very large arenas, a single memcpy() loop can't saturate memory bandwidth, so pack_parallel() splits
+    the copy across threads. Since a block's position in the packed buffer is just the sum of the used sizes
+    before it, each thread can be given an equal slice of the packed buffer and copy whatever parts of the
+    blocks land in it, which splits large blocks into stripes and small ones not at all, with no coordination
+    beyond the final join. A thread count of 0 uses one thread per hardware thread, and slices are kept to at
+    least ARENA_PARALLEL_PACK_MIN_SLICE bytes so small packs don't pay for thread creation.
+
+    Packs of at least STREAM_COPY_THRESHOLD bytes are copied with non-temporal stores (see stream_copy.h), so
+    the packed buffer goes straight to memory instead of also passing through the cache.
+
+    As in the linear allocator, alloc_align() aligns offsets rather than addresses, so every block's buffer is
+    allocated with the strictest alignment that will be requested: max_alignment if given, or
+    alignof(max_align_t) otherwise.
+
+    grow_in_place() extends the most recent allocation in the current block into the free space after it,
+    which is what lets a growable container (see arena_containers.h) that owns the last allocation grow
+    without copying. It returns false, changing nothing, for any other allocation or when the current block
+    doesn't have enough space left (it never moves to another block).
+
+    alloc_zeroed() is alloc() for memory that must start out zeroed, and it avoids the memset() where the
+    memory is known to be zero already. Each block tracks a dirty size: everything past it that hasn't been
+    handed out since is still zero. Whenever a block is emptied (by reset(), free(), rewind() or reuse from
+    a cache), its dirty size is raised to its old offset, and alloc_zeroed() only clears the part of an
+    allocation below the dirty size. Blocks from malloc() are dirty throughout, while blocks from a provider
+    that says they're zeroed (like ArenaMmapProvider's, which are fresh pages) start out clean. On Linux,
+    release_pages() hands the dirty pages past each block's offset back to the OS with MADV_DONTNEED, which
+    both lowers the memory footprint of an idle arena and makes those pages (zero-filled on the next touch)
+    clean again; elsewhere, it does nothing.
+
+    Since reset() and free() just rewind offsets, nothing allocated with alloc() ever has its destructor run,
+    so only trivially destructible data can live in the arena. make<T>(args...) lifts this restriction: it
+    constructs a T in the arena and, only if T isn't trivially destructible (decided at compile time),
+    places a two-pointer destructor record right after the object. The records form a list that reset(),
+    free() and the destructor run in reverse order of construction. Trivially destructible types get no
+    record, so make<T>() costs them nothing over alloc_align() and placement new.
+
+    Like the stack allocator's get_offset()/free_to_offset(), mark() and rewind() allow freeing allocations in
+    reverse order. A mark records the current block, its offset, the total size and the destructor list, and
+    rewinding empties every block after the marked one (up to the current one), restores the rest and runs the
+    destructors registered since. The emptied blocks stay in the chain to be advanced into again. Marks are
+    invalidated by reset() and free(), as well as by rewinding past them.
+
+    splice(other) moves everything allocated in another arena into this one without copying, for fork-join
+    workloads where each thread builds into its own arena and the results end up in one. The other arena's
+    used blocks are linked in after the current block (which is padded like when growth leaves it), its last
+    used block becomes the current one, and the sizes are added up, so objects keep their addresses. Its
+    destructor records and large blocks are linked in as well, which is O(1) because the oldest destructor
+    record and the last large block are tracked. Only its relocations, if any, are copied, since they're in a
+    side table. The other arena is left empty but usable, keeping its unused blocks (or getting a fresh one,
+    sized like its first block, if it has none), and its marks are invalidated. Splicing an arena that is
+    already empty (an idle worker's, say) changes neither arena. Both arenas must have the same alignment
+    and block provider, since blocks are sized and released according to them.
+
+    For nested lifetimes (a session arena with an arena per request, say), ArenaAllocator(parent, capacity)
+    creates a child arena that shares the parent's alignment, growth policy and provider. A child takes its
+    blocks from the parent's cache when one is big enough, and its destructor and free() give its blocks
+    back to that cache instead of releasing them, so blocks are recycled within the hierarchy and only the
+    parent (through its own free() or destructor) ever gives them back to the provider. Returning the blocks
+    is O(1), since the last block of both the chain and the cache is tracked. A child's large blocks go back
+    to the cache as well (they may have come from it), so large allocations in children can't drain it. A
+    child may itself be a parent, the parent must outlive its children, and all of them must be used from
+    the same thread.
+
+    Packing moves every block's data, so raw pointers between objects in the arena are useless in the packed
+    copy. ArenaRelPtr<T> stores the distance from itself to its target instead of an address, so it stays
+    valid wherever the data is moved, as long as the distance is preserved. That's automatically the case
+    when both ends are in the same block, but not when they're in different blocks, since packing closes the
+    gaps between them. For those, add_relocation() records where the pointer lives, and pack() recomputes the
+    distance in the packed copy. The result is a position-independent image that can be written out, mapped
+    back at any address and traversed directly with no fix-up pass. Recording only costs an entry in a side
+    table (not in the arena, so it doesn't show up in the packed data), and it's always safe to record a
+    pointer whose ends turn out to be in the same block. A null ArenaRelPtr stores a distance of 1, not 0,
+    since 0 is a valid distance (a pointer to itself, as in a one-node circular list) and 1 never is (the
+    target would start inside the pointer); zeroed memory therefore doesn't read as null. pack_iovec() hands
+    out the blocks as they are, so relocations aren't applied to it. For the packed data to be usable in
+    place, it must also keep its alignment, so when growth leaves a block, the block's used size is padded to
+    a multiple of the buffer alignment (block capacities are rounded up so that this always fits).
+
+    Building on that, save() streams the packed data (through pack_to()) to a file behind a small header
+    (magic, version, pointer size, alignment and size), and ArenaImage::load() maps such a file back, so
+    structures that take minutes to build can be reloaded in milliseconds. The data starts on a page boundary
+    in the file, so it keeps its alignment when mapped, which is also why save() fails for arenas aligned to
+    more than ARENA_IMAGE_PAGE_SIZE. An image is mapped either read-only or copy-on-write (MAP_PRIVATE), in
+    which case writes go to private copies of the touched pages and never reach the file. The header is
+    written in native byte order with native pointer size, and load() rejects images that don't match, since
+    the ArenaRelPtr distances in them wouldn't be readable anyway.
+
+    How blocks are sized and where they come from can be customized. An ArenaGrowthPolicy sets the factor by
+    which each new block grows over the previous one (1.5 by default; 1.0 gives fixed-size blocks), a cap on
+    block capacity, and a granularity (e.g. the page or huge page size) that the full block allocation,
+    header included, is rounded up to, with the extra space going to the block's capacity. An allocation
+    larger than the cap still gets a block of its own size. An ArenaBlockProvider supplies the memory for
+    blocks instead of malloc(). ArenaMmapProvider maps blocks directly from the OS (optionally asking for
+    transparent huge pages); other sources, like a pool of blocks or another arena, are a matter of
+    implementing its two functions. The provider must outlive the arena, and its blocks must be aligned to
+    at least alignof(max_align_t).
+
+    Normally, an allocation that doesn't fit in the current block starts a new one, abandoning the rest of the
+    current block, and a huge allocation also inflates the size of every block after it. With a
+    large_allocation_threshold in the growth policy, allocations of at least that size that don't fit get a
+    dedicated block (from the provider, so possibly mapped straight from the OS) on a side list instead,
+    leaving the current block and the growth sequence untouched. Large blocks are released by reset(), free()
+    and rewind() rather than kept for reuse (a child arena's go back to its parent's cache, see above). In
+    the packed layout, they come after the chain, in allocation order, so the first object allocated is
+    still at the start of the packed data. The chain's used size isn't necessarily a multiple of the buffer
+    alignment, so it's padded (with zeros) when packing, and each large block is padded to the alignment,
+    which keeps every large block aligned in the packed data.
+
+    An arena that fills several blocks every cycle keeps paying for the hops between them, and its data stays
+    scattered, even though the blocks are reused. With consolidate_on_reset in the growth policy, reset()
+    keeps a smoothed size of the cycles (an exponential moving average of the used size of the chain, with
+    consolidation_smoothing as the weight of the latest cycle), and when a cycle spanned several blocks and
+    the smoothed size no longer fits in the first block, it replaces the whole chain (and the cache) with a
+    single block of that size. The steady state is then one contiguous block, without one unusual cycle
+    setting the size for good. Large blocks don't count toward the cycle size. The consolidated block is
+    still capped at max_block_size, so with a cap smaller than the cycle, the chain is consolidated into a
+    first block of the cap, and the rest of the cycle grows after it as usual.
+
+    Defining ARENA_ALLOC_STATS before including this file enables statistics for tuning block sizes and
+    alignment: payload bytes (what callers asked for), padding bytes (alignment padding, which _total_size
+    lumps together with payload), tail waste (space left at the end of blocks that growth moved past), the
+    number of blocks owned and the peak total size. They're compiled out entirely otherwise, so the
+    allocation path is untouched. Payload, padding and tail waste describe the current contents, so reset(),
+    free() and rewind() roll them back, while the block count and peak carry on.
 */
 
 #ifndef ARENA_ALLOC_H
@@ -26,152 +164,1458 @@
 #include <cstdlib>
 #include <cstddef>
 #include <cstring>
+#include <cstdint>
 #include <cassert>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include <cstdio>
+#include <thread>
+
+#include "stream_copy.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // Or windows.h defines min()/max() macros that break std::min()/std::max()
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+constexpr ptrdiff_t ARENA_REL_PTR_NULL = 1; // No target can start one byte into the pointer itself
+
+constexpr size_t ARENA_PARALLEL_PACK_MIN_SLICE = 4 * 1024 * 1024;
+
+constexpr size_t ARENA_SAVE_CHUNK_SIZE = 1024 * 1024;
+
+constexpr uint64_t ARENA_IMAGE_MAGIC = 0x31474d4941524e41; // "ANRAIMG1" read as a little-endian integer
+constexpr uint32_t ARENA_IMAGE_VERSION = 2; // 2: null ArenaRelPtrs are ARENA_REL_PTR_NULL instead of 0
+constexpr uint64_t ARENA_IMAGE_PAGE_SIZE = 4096;
 
-struct ArenaBlock
+struct ArenaImageHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t pointer_size;
+    uint64_t alignment;
+    uint64_t data_offset; // From the start of the file
+    uint64_t data_size;
+};
+
+struct ArenaGrowthPolicy
+{
+    double growth_factor = 1.5; // New block capacity relative to the previous block
+    size_t max_block_size = 0; // Capacity cap (0 for none), except for single allocations larger than it
+    size_t granularity = 0; // Block allocations are rounded up to a multiple of this (0 for none)
+    size_t large_allocation_threshold = 0; // Allocations at least this big get their own block (0 for never)
+    bool consolidate_on_reset = false; // Replace the chain with one block sized to the smoothed cycle size (up to max_block_size)
+    double consolidation_smoothing = 0.5; // Weight of the latest cycle in the smoothed size
+};
+
+class ArenaBlockProvider
+{
+    public:
+        virtual ~ArenaBlockProvider() {}
+        virtual void *allocate_block(size_t size) = 0;
+        virtual void release_block(void *block, size_t size) = 0;
+        virtual bool zeroes_blocks() { return false; } // Whether new blocks are guaranteed to be zeroed
+};
+
+class ArenaMmapProvider : public ArenaBlockProvider
+{
+    private:
+        bool _huge_pages;
+
+    public:
+        ArenaMmapProvider();
+        ArenaMmapProvider(bool huge_pages);
+        void *allocate_block(size_t size);
+        void release_block(void *block, size_t size);
+        bool zeroes_blocks();
+};
+
+struct alignas(max_align_t) ArenaBlock // So the buffer right after the header is aligned too
 {
     ArenaBlock *next;
     size_t offset;
     size_t capacity;
+    size_t dirty_size; // The buffer is zero past this, except for what has been handed out since
     unsigned char *buffer;
 };
 
+#if defined(ARENA_ALLOC_STATS)
+struct ArenaStats
+{
+    size_t payload_size;
+    size_t padding_size;
+    size_t tail_waste;
+    size_t block_count; // Including cached blocks
+    size_t peak_size;
+};
+#endif
+
+struct ArenaDestructor
+{
+    ArenaDestructor *prev;
+    void (*destroy)(ArenaDestructor *record); // Finds the object from the record's address
+};
+
+struct ArenaPatch
+{
+    size_t offset; // In the packed data
+    ptrdiff_t distance;
+};
+
+struct ArenaMark
+{
+    ArenaBlock *block;
+    size_t offset;
+    size_t total_size;
+    ArenaDestructor *destructors;
+    size_t relocation_count;
+    ArenaBlock *large_tail;
+#if defined(ARENA_ALLOC_STATS)
+    ArenaStats stats;
+#endif
+};
+
+template <typename T>
+class ArenaRelPtr
+{
+    private:
+        ptrdiff_t _distance; // From this to the target, ARENA_REL_PTR_NULL for null
+
+    public:
+        ArenaRelPtr();
+        ArenaRelPtr(T *target);
+        ArenaRelPtr(const ArenaRelPtr &other);
+        ArenaRelPtr &operator=(const ArenaRelPtr &other);
+        ArenaRelPtr &operator=(T *target);
+        T *get() const;
+        void set(T *target);
+        T *operator->() const;
+        T &operator*() const;
+        explicit operator bool() const;
+};
+
 class ArenaAllocator
 {
     private:
         ArenaBlock *_head;
         ArenaBlock *_current;
+        ArenaBlock *_tail; // Last block of the chain, so the chain can be handed to a parent in O(1)
         size_t _total_size; // So packing is O(n) instead of O(n^2)
+        size_t _max_alignment;
+        ArenaGrowthPolicy _growth_policy;
+        ArenaBlockProvider *_provider; // Null for malloc()
+        ArenaBlock *_cached_blocks; // Spare blocks unlinked from the chain, reused before creating new ones
+        ArenaBlock *_cached_tail;
+        ArenaAllocator *_parent; // Where blocks come from and go back to, null for the provider
+        ArenaBlock *_large_blocks; // Dedicated blocks for large allocations, oldest first
+        ArenaBlock *_large_tail;
+        size_t _large_size; // The part of _total_size in large blocks
+        ArenaBlock _large_gap; // Stands for the padding between the chain and the large blocks when packing
+        unsigned char *_gap_padding; // Zeros for _large_gap, allocated with the first large block
+        size_t _smoothed_cycle_size; // For consolidate_on_reset, 0 before the first cycle
+        ArenaDestructor *_destructors; // Most recent first
+        ArenaDestructor *_oldest_destructor; // So another arena's list can be linked in front of this one in O(1)
+        unsigned char **_relocations; // Addresses of ArenaRelPtrs to recompute when packing
+        size_t _relocation_count;
+        size_t _relocation_capacity;
+#if defined(ARENA_ALLOC_STATS)
+        ArenaStats _stats;
+#endif
+
+        void init(size_t capacity, size_t max_alignment, const ArenaGrowthPolicy &growth_policy, ArenaBlockProvider *provider, ArenaAllocator *parent);
+        ArenaBlock *create_block(size_t capacity);
+        size_t block_allocation_size(size_t capacity);
+        size_t next_block_capacity(size_t size);
+        ArenaBlock *take_cached_block(size_t size);
+        void release_blocks(ArenaBlock *block);
+        void recycle_blocks(ArenaBlock *first, ArenaBlock *last);
+        static void empty_block(ArenaBlock *block);
+        static void release_block_pages(ArenaBlock *block);
+        void cache_block(ArenaBlock *block);
+        void *grow(size_t size);
+        void *alloc_large(size_t size);
+        void release_large_blocks(ArenaBlock *keep_tail); // Releases the ones allocated after keep_tail
+        bool allocate_gap_padding();
+        size_t prepare_packed_layout();
+        void consolidate_blocks();
+        ArenaBlock *first_packed_block();
+        ArenaBlock *next_packed_block(ArenaBlock *block);
+        void run_destructors(ArenaDestructor *stop); // Runs the ones registered after stop
+        bool add_relocation_address(unsigned char *address);
+        bool packed_offset(const unsigned char *address, size_t *offset);
+        bool relocated_distance(unsigned char *pointer, size_t *pointer_offset, ptrdiff_t *distance);
+        void apply_relocations(unsigned char *packed_buffer);
+        ArenaPatch *collect_patches(size_t *patch_count);
+        static void apply_patches(const ArenaPatch *patches, size_t patch_count, size_t *first_patch, unsigned char *chunk, size_t chunk_offset, size_t chunk_size);
+        void pack_slice(unsigned char *packed_buffer, size_t slice_start, size_t slice_end);
+#if defined(ARENA_ALLOC_STATS)
+        void record_allocation(size_t size, size_t padding);
+#endif
+
+        template <typename T>
+        static void destroy_object(ArenaDestructor *record);
+        template <typename T, typename... Args>
+        T *make_object(std::true_type trivially_destructible, Args &&... args);
+        template <typename T, typename... Args>
+        T *make_object(std::false_type trivially_destructible, Args &&... args);
 
     public:
         ArenaAllocator(size_t capacity);
+        ArenaAllocator(size_t capacity, size_t max_alignment);
+        ArenaAllocator(size_t capacity, size_t max_alignment, const ArenaGrowthPolicy &growth_policy, ArenaBlockProvider *provider);
+        ArenaAllocator(ArenaAllocator &parent, size_t capacity);
         ~ArenaAllocator();
         void *alloc(size_t size);
         void *alloc_align(size_t size, size_t alignment);
+        void *alloc_zeroed(size_t size);
+        bool grow_in_place(void *memory, size_t old_size, size_t new_size);
+        template <typename T, typename... Args>
+        T *make(Args &&... args);
+        ArenaMark mark();
+        void rewind(ArenaMark mark);
+        template <typename T>
+        bool add_relocation(ArenaRelPtr<T> *pointer);
         void reset();
         void free();
+        bool splice(ArenaAllocator &other);
+        size_t capacity();
+        void release_pages();
         void *pack(size_t *packed_size);
+        void *pack_parallel(size_t *packed_size, unsigned thread_count);
+        size_t pack_iovec(struct iovec *iovecs, size_t max_count);
+        template <typename Writer>
+        bool pack_to(Writer writer, size_t chunk_size);
+        bool save(const char *path);
+#if defined(ARENA_ALLOC_STATS)
+        ArenaStats stats();
+#endif
 };
 
-ArenaAllocator::ArenaAllocator(size_t capacity)
+class ArenaImage
+{
+    private:
+        void *_mapping;
+        size_t _mapping_size;
+        unsigned char *_data;
+        size_t _size;
+
+    public:
+        ArenaImage();
+        ~ArenaImage();
+        bool load(const char *path, bool copy_on_write);
+        void unload();
+        void *data();
+        size_t size();
+};
+
+template <typename T>
+ArenaRelPtr<T>::ArenaRelPtr()
+{
+    _distance = ARENA_REL_PTR_NULL;
+}
+
+template <typename T>
+ArenaRelPtr<T>::ArenaRelPtr(T *target)
+{
+    set(target);
+}
+
+template <typename T>
+ArenaRelPtr<T>::ArenaRelPtr(const ArenaRelPtr &other)
+{
+    set(other.get());
+}
+
+template <typename T>
+ArenaRelPtr<T> &ArenaRelPtr<T>::operator=(const ArenaRelPtr &other)
+{
+    set(other.get());
+    return *this;
+}
+
+template <typename T>
+ArenaRelPtr<T> &ArenaRelPtr<T>::operator=(T *target)
+{
+    set(target);
+    return *this;
+}
+
+template <typename T>
+T *ArenaRelPtr<T>::get() const
+{
+    if (_distance == ARENA_REL_PTR_NULL)
+        return nullptr;
+    return reinterpret_cast<T *>(reinterpret_cast<uintptr_t>(this) + _distance);
+}
+
+template <typename T>
+void ArenaRelPtr<T>::set(T *target)
+{
+    if (!target)
+        _distance = ARENA_REL_PTR_NULL;
+    else
+        _distance = static_cast<ptrdiff_t>(reinterpret_cast<uintptr_t>(target) - reinterpret_cast<uintptr_t>(this));
+}
+
+template <typename T>
+T *ArenaRelPtr<T>::operator->() const
+{
+    return get();
+}
+
+template <typename T>
+T &ArenaRelPtr<T>::operator*() const
+{
+    return *get();
+}
+
+template <typename T>
+ArenaRelPtr<T>::operator bool() const
+{
+    return _distance != ARENA_REL_PTR_NULL;
+}
+
+ArenaAllocator::ArenaAllocator(size_t capacity) : ArenaAllocator(capacity, alignof(max_align_t))
+{
+}
+
+ArenaAllocator::ArenaAllocator(size_t capacity, size_t max_alignment) : ArenaAllocator(capacity, max_alignment, ArenaGrowthPolicy(), nullptr)
+{
+}
+
+ArenaAllocator::ArenaAllocator(size_t capacity, size_t max_alignment, const ArenaGrowthPolicy &growth_policy, ArenaBlockProvider *provider)
+{
+    init(capacity, max_alignment, growth_policy, provider, nullptr);
+}
+
+ArenaAllocator::ArenaAllocator(ArenaAllocator &parent, size_t capacity)
+{
+    // Same block geometry and source as the parent, so blocks can move between them as they are
+    init(capacity, parent._max_alignment, parent._growth_policy, parent._provider, &parent);
+}
+
+void ArenaAllocator::init(size_t capacity, size_t max_alignment, const ArenaGrowthPolicy &growth_policy, ArenaBlockProvider *provider, ArenaAllocator *parent)
+{
+    assert((max_alignment & (max_alignment - 1)) == 0); // Alignment must be a power of two
+    assert(growth_policy.growth_factor >= 1.0);
+    assert(growth_policy.consolidation_smoothing > 0.0 && growth_policy.consolidation_smoothing <= 1.0);
+
+    _max_alignment = std::max(max_alignment, alignof(max_align_t));
+    _growth_policy = growth_policy;
+    _provider = provider;
+    _parent = parent;
+#if defined(ARENA_ALLOC_STATS)
+    memset(&_stats, 0, sizeof(_stats));
+#endif
+    _head = _current = _tail = create_block(capacity);
+    _total_size = 0;
+    _cached_blocks = _cached_tail = nullptr;
+    _large_blocks = _large_tail = nullptr;
+    _large_size = 0;
+    _large_gap.next = nullptr;
+    _large_gap.offset = 0;
+    _large_gap.capacity = 0;
+    _large_gap.dirty_size = 0;
+    _large_gap.buffer = nullptr;
+    _gap_padding = nullptr;
+    _smoothed_cycle_size = 0;
+    _destructors = _oldest_destructor = nullptr;
+    _relocations = nullptr;
+    _relocation_count = 0;
+    _relocation_capacity = 0;
+}
+
+ArenaAllocator::~ArenaAllocator()
 {
-    ArenaBlock *block = static_cast<ArenaBlock *>(malloc(sizeof(ArenaBlock) + capacity));
+    run_destructors(nullptr);
+    recycle_blocks(_head, _tail);
+    recycle_blocks(_cached_blocks, _cached_tail);
+    recycle_blocks(_large_blocks, _large_tail);
+    std::free(_relocations);
+    std::free(_gap_padding);
+}
+
+ArenaBlock *ArenaAllocator::create_block(size_t capacity)
+{
+    capacity = (capacity + _max_alignment - 1) & ~(_max_alignment - 1); // So a block's used size can always be padded to the alignment
+
+    // The buffer follows the header, which is only aligned to alignof(max_align_t)
+    size_t padding = _max_alignment > alignof(max_align_t) ? _max_alignment - 1 : 0;
+    if (_growth_policy.granularity)
+    {
+        size_t granularity = _growth_policy.granularity;
+        size_t allocation_size = (sizeof(ArenaBlock) + padding + capacity + granularity - 1) / granularity * granularity;
+        capacity = (allocation_size - sizeof(ArenaBlock) - padding) & ~(_max_alignment - 1);
+    }
+
+    if (_parent)
+    {
+        ArenaBlock *block = _parent->take_cached_block(capacity);
+        if (block)
+        {
+#if defined(ARENA_ALLOC_STATS)
+            _parent->_stats.block_count--;
+            _stats.block_count++;
+#endif
+            return block;
+        }
+    }
+
+    size_t allocation_size = block_allocation_size(capacity);
+    void *memory = _provider ? _provider->allocate_block(allocation_size) : malloc(allocation_size);
+    if (!memory)
+        return nullptr;
+
+#if defined(ARENA_ALLOC_STATS)
+    _stats.block_count++;
+#endif
+
+    ArenaBlock *block = static_cast<ArenaBlock *>(memory);
     block->next = nullptr;
     block->offset = 0;
     block->capacity = capacity;
-    block->buffer = reinterpret_cast<unsigned char *>(block + 1);
-    _head = _current = block;
-    _total_size = 0;
+    block->dirty_size = _provider && _provider->zeroes_blocks() ? 0 : capacity;
+    block->buffer = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(block + 1) + padding) & ~(uintptr_t)(_max_alignment - 1));
+    return block;
 }
 
-ArenaAllocator::~ArenaAllocator()
+size_t ArenaAllocator::block_allocation_size(size_t capacity)
+{
+    size_t padding = _max_alignment > alignof(max_align_t) ? _max_alignment - 1 : 0;
+    return sizeof(ArenaBlock) + padding + capacity;
+}
+
+size_t ArenaAllocator::next_block_capacity(size_t size)
+{
+    size_t capacity = static_cast<size_t>(_current->capacity * _growth_policy.growth_factor);
+    if (_growth_policy.max_block_size && capacity > _growth_policy.max_block_size)
+        capacity = _growth_policy.max_block_size;
+    return std::max(capacity, size);
+}
+
+ArenaBlock *ArenaAllocator::take_cached_block(size_t size)
+{
+    ArenaBlock *previous = nullptr;
+    ArenaBlock **link = &_cached_blocks;
+    while (*link)
+    {
+        ArenaBlock *block = *link;
+        if (block->capacity >= size)
+        {
+            *link = block->next;
+            if (block == _cached_tail)
+                _cached_tail = previous;
+            block->next = nullptr;
+            empty_block(block); // Blocks handed back by a child arena still have their offsets
+            return block;
+        }
+        previous = block;
+        link = &block->next;
+    }
+    return nullptr;
+}
+
+void ArenaAllocator::release_blocks(ArenaBlock *block)
 {
-    ArenaBlock *block = _head;
     while (block)
     {
         ArenaBlock *next = block->next;
-        std::free(block);
+        if (_provider)
+            _provider->release_block(block, block_allocation_size(block->capacity));
+        else
+            std::free(block);
+#if defined(ARENA_ALLOC_STATS)
+        _stats.block_count--;
+#endif
         block = next;
     }
 }
 
-void *ArenaAllocator::alloc(size_t size)
+void ArenaAllocator::recycle_blocks(ArenaBlock *first, ArenaBlock *last)
 {
-    constexpr size_t DEFAULT_ALIGNMENT = alignof(max_align_t);
+    if (!first)
+        return;
+    if (!_parent)
+    {
+        release_blocks(first);
+        return;
+    }
 
-    size_t corrected_offset = (_current->offset + DEFAULT_ALIGNMENT - 1) & ~(DEFAULT_ALIGNMENT - 1);
-    if (size > _current->capacity - corrected_offset)
+#if defined(ARENA_ALLOC_STATS)
+    size_t block_count = 1; // Blocks are few, and this is only for the statistics
+    for (ArenaBlock *block = first; block != last; block = block->next)
+        block_count++;
+    _stats.block_count -= block_count;
+    _parent->_stats.block_count += block_count;
+#endif
+
+    // The whole run goes to the front of the parent's cache at once
+    last->next = _parent->_cached_blocks;
+    if (!_parent->_cached_blocks)
+        _parent->_cached_tail = last;
+    _parent->_cached_blocks = first;
+}
+
+void ArenaAllocator::empty_block(ArenaBlock *block)
+{
+    block->dirty_size = std::max(block->dirty_size, block->offset);
+    block->offset = 0;
+}
+
+void ArenaAllocator::cache_block(ArenaBlock *block)
+{
+    block->next = _cached_blocks;
+    if (!_cached_blocks)
+        _cached_tail = block;
+    _cached_blocks = block;
+}
+
+void *ArenaAllocator::grow(size_t size)
+{
+    if (_growth_policy.large_allocation_threshold && size >= _growth_policy.large_allocation_threshold)
+        return alloc_large(size);
+
+    // Blocks after the current one are empty (left over from before reset()), so move the ones that are too small to the cache
+    while (_current->next && _current->next->capacity < size)
+    {
+        ArenaBlock *skipped_block = _current->next;
+        _current->next = skipped_block->next;
+        if (skipped_block == _tail)
+            _tail = _current;
+        cache_block(skipped_block);
+    }
+
+    // Pad the block being left so the next one's data stays aligned in the packed layout
+    size_t padded_offset = (_current->offset + _max_alignment - 1) & ~(_max_alignment - 1);
+    size_t end_padding = padded_offset - _current->offset;
+    _total_size += end_padding;
+    _current->offset = padded_offset;
+
+    ArenaBlock *new_block = _current->next;
+    if (!new_block)
     {
-        ArenaBlock *new_block = static_cast<ArenaBlock *>(malloc(sizeof(ArenaBlock) + size));
-        new_block->next = _current->next;
-        new_block->offset = 0;
-        new_block->capacity = static_cast<size_t>(std::max(_current->capacity * 1.5, (double)size));
-        new_block->buffer = reinterpret_cast<unsigned char *>(new_block + 1);
+        new_block = take_cached_block(size);
+        if (!new_block)
+            new_block = create_block(next_block_capacity(size));
+        if (!new_block)
+            return nullptr; // Out of memory
         _current->next = new_block;
-        _current = new_block;
-        _current->offset += size;
-        _total_size += size;
-        return new_block + 1;
+        _tail = new_block;
     }
+
+#if defined(ARENA_ALLOC_STATS)
+    _stats.padding_size += end_padding;
+    _stats.tail_waste += _current->capacity - padded_offset;
+    record_allocation(size, 0);
+#endif
+
+    _current = new_block;
+    _current->offset = size;
+    _total_size += size;
+    return _current->buffer;
+}
+
+void *ArenaAllocator::alloc_large(size_t size)
+{
+    if (!allocate_gap_padding())
+        return nullptr; // Out of memory
+
+    ArenaBlock *block = create_block(size);
+    if (!block)
+        return nullptr; // Out of memory
+
+    // Padded so whatever follows in the packed layout stays aligned (the capacity is rounded, so this fits)
+    block->offset = (size + _max_alignment - 1) & ~(_max_alignment - 1);
+#if defined(ARENA_ALLOC_STATS)
+    record_allocation(size, block->offset - size);
+#endif
+    _total_size += block->offset;
+    _large_size += block->offset;
+
+    if (_large_tail)
+        _large_tail->next = block;
+    else
+        _large_blocks = block;
+    _large_tail = block;
+    return block->buffer;
+}
+
+void ArenaAllocator::release_large_blocks(ArenaBlock *keep_tail)
+{
+    ArenaBlock *block = keep_tail ? keep_tail->next : _large_blocks;
+    if (keep_tail)
+        keep_tail->next = nullptr;
     else
+        _large_blocks = nullptr;
+    _large_tail = keep_tail;
+
+    if (!block)
+        return;
+
+    // A child's large blocks may have come from the parent's cache, so they go back there like its chain
+    ArenaBlock *last = block;
+    _large_size -= last->offset;
+    while (last->next)
     {
-        _total_size += size + corrected_offset - _current->offset; // += size + offset shift
-        _current->offset = corrected_offset + size;
-        return &(_current->buffer[corrected_offset - size]);
+        last = last->next;
+        _large_size -= last->offset;
     }
+    recycle_blocks(block, last);
+}
+
+bool ArenaAllocator::allocate_gap_padding()
+{
+    // The gap is always smaller than the alignment
+    if (!_gap_padding)
+        _gap_padding = static_cast<unsigned char *>(calloc(1, _max_alignment));
+    return _gap_padding != nullptr;
+}
+
+size_t ArenaAllocator::prepare_packed_layout()
+{
+    // Returns the packed size
+    size_t chain_size = _total_size - _large_size;
+    _large_gap.offset = _large_blocks ? (0 - chain_size) & (_max_alignment - 1) : 0;
+    _large_gap.buffer = _gap_padding;
+    _large_gap.next = _large_blocks;
+    return _total_size + _large_gap.offset;
+}
+
+ArenaBlock *ArenaAllocator::first_packed_block()
+{
+    return _head;
+}
+
+ArenaBlock *ArenaAllocator::next_packed_block(ArenaBlock *block)
+{
+    // The chain, then the gap (if any), then the large blocks in allocation order
+    if (block == _tail)
+        return _large_gap.offset ? &_large_gap : _large_blocks;
+    return block->next;
+}
+
+void *ArenaAllocator::alloc(size_t size)
+{
+    constexpr size_t DEFAULT_ALIGNMENT = alignof(max_align_t);
+
+    size_t corrected_offset = (_current->offset + DEFAULT_ALIGNMENT - 1) & ~(DEFAULT_ALIGNMENT - 1);
+    if (corrected_offset > _current->capacity || size > _current->capacity - corrected_offset)
+        return grow(size);
+
+#if defined(ARENA_ALLOC_STATS)
+    record_allocation(size, corrected_offset - _current->offset);
+#endif
+    _total_size += size + corrected_offset - _current->offset; // += size + offset shift
+    _current->offset = corrected_offset + size;
+    return &(_current->buffer[corrected_offset]);
 }
 
 void *ArenaAllocator::alloc_align(size_t size, size_t alignment)
 {
     assert((alignment & (alignment - 1)) == 0); // Alignment must be a power of two
+    assert(alignment <= _max_alignment); // Block buffers are only aligned to _max_alignment
 
     size_t corrected_offset = (_current->offset + alignment - 1) & ~(alignment - 1);
-    if (size > _current->capacity - corrected_offset)
+    if (corrected_offset > _current->capacity || size > _current->capacity - corrected_offset)
+        return grow(size);
+
+#if defined(ARENA_ALLOC_STATS)
+    record_allocation(size, corrected_offset - _current->offset);
+#endif
+    _total_size += size + corrected_offset - _current->offset; // += size + offset shift
+    _current->offset = corrected_offset + size;
+    return &(_current->buffer[corrected_offset]);
+}
+
+bool ArenaAllocator::grow_in_place(void *memory, size_t old_size, size_t new_size)
+{
+    // Only the last allocation ends at the offset
+    if (new_size < old_size || static_cast<unsigned char *>(memory) + old_size != _current->buffer + _current->offset)
+        return false;
+    if (new_size - old_size > _current->capacity - _current->offset)
+        return false; // Out of space
+
+#if defined(ARENA_ALLOC_STATS)
+    record_allocation(new_size - old_size, 0);
+#endif
+    _total_size += new_size - old_size;
+    _current->offset += new_size - old_size;
+    return true;
+}
+
+void *ArenaAllocator::alloc_zeroed(size_t size)
+{
+    unsigned char *memory = static_cast<unsigned char *>(alloc(size));
+    if (!memory)
+        return nullptr;
+
+    // The allocation is in the current block, or in a new large block
+    ArenaBlock *block = _large_tail && memory == _large_tail->buffer ? _large_tail : _current;
+    size_t start = memory - block->buffer;
+    if (start < block->dirty_size)
+        memset(memory, 0, std::min(size, block->dirty_size - start));
+    return memory;
+}
+
+template <typename T>
+void ArenaAllocator::destroy_object(ArenaDestructor *record)
+{
+    constexpr size_t record_offset = (sizeof(T) + alignof(ArenaDestructor) - 1) & ~(alignof(ArenaDestructor) - 1);
+    reinterpret_cast<T *>(reinterpret_cast<unsigned char *>(record) - record_offset)->~T();
+}
+
+template <typename T, typename... Args>
+T *ArenaAllocator::make_object(std::true_type, Args &&... args)
+{
+    void *memory = alloc_align(sizeof(T), alignof(T));
+    if (!memory)
+        return nullptr;
+    return new (memory) T(std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+T *ArenaAllocator::make_object(std::false_type, Args &&... args)
+{
+    // The record goes right after the object, so no pointer to the object needs to be stored
+    constexpr size_t record_offset = (sizeof(T) + alignof(ArenaDestructor) - 1) & ~(alignof(ArenaDestructor) - 1);
+    constexpr size_t alignment = alignof(T) > alignof(ArenaDestructor) ? alignof(T) : alignof(ArenaDestructor);
+
+    unsigned char *memory = static_cast<unsigned char *>(alloc_align(record_offset + sizeof(ArenaDestructor), alignment));
+    if (!memory)
+        return nullptr;
+
+    T *object = new (memory) T(std::forward<Args>(args)...);
+    ArenaDestructor *record = reinterpret_cast<ArenaDestructor *>(memory + record_offset);
+    record->prev = _destructors;
+    record->destroy = &destroy_object<T>;
+    if (!_destructors)
+        _oldest_destructor = record;
+    _destructors = record;
+    return object;
+}
+
+template <typename T, typename... Args>
+T *ArenaAllocator::make(Args &&... args)
+{
+    return make_object<T>(typename std::is_trivially_destructible<T>::type(), std::forward<Args>(args)...);
+}
+
+void ArenaAllocator::run_destructors(ArenaDestructor *stop)
+{
+    while (_destructors != stop)
     {
-        ArenaBlock *new_block = static_cast<ArenaBlock *>(malloc(sizeof(ArenaBlock) + size));
-        new_block->next = _current->next;
-        new_block->offset = 0;
-        new_block->capacity = static_cast<size_t>(std::max(_current->capacity * 1.5, (double)size));
-        new_block->buffer = reinterpret_cast<unsigned char *>(new_block + 1);
-        _current->next = new_block;
-        _current = new_block;
-        _current->offset += size;
-        _total_size += size;
-        return new_block + 1;
+        ArenaDestructor *record = _destructors;
+        _destructors = record->prev;
+        record->destroy(record);
     }
-    else
+    if (!_destructors)
+        _oldest_destructor = nullptr;
+}
+
+ArenaMark ArenaAllocator::mark()
+{
+    ArenaMark mark;
+    mark.block = _current;
+    mark.offset = _current->offset;
+    mark.total_size = _total_size;
+    mark.destructors = _destructors;
+    mark.relocation_count = _relocation_count;
+    mark.large_tail = _large_tail;
+#if defined(ARENA_ALLOC_STATS)
+    mark.stats = _stats;
+#endif
+    return mark;
+}
+
+void ArenaAllocator::rewind(ArenaMark mark)
+{
+    run_destructors(mark.destructors);
+    release_large_blocks(mark.large_tail);
+
+    if (mark.block != _current)
+    {
+        ArenaBlock *block = mark.block->next;
+        while (block != _current)
+        {
+            empty_block(block);
+            block = block->next;
+        }
+        empty_block(_current);
+        _current = mark.block;
+    }
+
+    assert(mark.offset <= _current->offset);
+    _current->dirty_size = std::max(_current->dirty_size, _current->offset);
+    _current->offset = mark.offset;
+    _total_size = mark.total_size;
+    _relocation_count = mark.relocation_count;
+#if defined(ARENA_ALLOC_STATS)
+    _stats.payload_size = mark.stats.payload_size;
+    _stats.padding_size = mark.stats.padding_size;
+    _stats.tail_waste = mark.stats.tail_waste;
+#endif
+}
+
+template <typename T>
+bool ArenaAllocator::add_relocation(ArenaRelPtr<T> *pointer)
+{
+    static_assert(sizeof(ArenaRelPtr<T>) == sizeof(ptrdiff_t), "ArenaRelPtr must be exactly one distance");
+    return add_relocation_address(reinterpret_cast<unsigned char *>(pointer));
+}
+
+bool ArenaAllocator::add_relocation_address(unsigned char *address)
+{
+    if (_relocation_count == _relocation_capacity)
+    {
+        size_t new_capacity = _relocation_capacity ? _relocation_capacity * 2 : 64;
+        unsigned char **new_relocations = static_cast<unsigned char **>(realloc(_relocations, new_capacity * sizeof(unsigned char *)));
+        if (!new_relocations)
+            return false; // Out of memory
+        _relocations = new_relocations;
+        _relocation_capacity = new_capacity;
+    }
+    _relocations[_relocation_count++] = address;
+    return true;
+}
+
+bool ArenaAllocator::packed_offset(const unsigned char *address, size_t *offset)
+{
+    // Blocks are few (they grow geometrically), so a linear walk is fine
+    size_t block_start = 0;
+    for (ArenaBlock *block = first_packed_block(); block; block = next_packed_block(block))
+    {
+        if (address >= block->buffer && address < block->buffer + block->offset)
+        {
+            *offset = block_start + (address - block->buffer);
+            return true;
+        }
+        block_start += block->offset;
+    }
+    return false;
+}
+
+bool ArenaAllocator::relocated_distance(unsigned char *pointer, size_t *pointer_offset, ptrdiff_t *distance)
+{
+    ptrdiff_t live_distance;
+    memcpy(&live_distance, pointer, sizeof(ptrdiff_t));
+    if (live_distance == ARENA_REL_PTR_NULL)
+        return false; // Null
+
+    size_t target_offset;
+    const unsigned char *target = reinterpret_cast<const unsigned char *>(reinterpret_cast<uintptr_t>(pointer) + live_distance);
+    if (!packed_offset(pointer, pointer_offset) || !packed_offset(target, &target_offset))
+        return false; // Not in the packed data, so there's nothing meaningful to write
+
+    *distance = static_cast<ptrdiff_t>(target_offset) - static_cast<ptrdiff_t>(*pointer_offset);
+    return true;
+}
+
+void ArenaAllocator::apply_relocations(unsigned char *packed_buffer)
+{
+    for (size_t i = 0; i < _relocation_count; i++)
     {
-        _total_size += size + corrected_offset - _current->offset; // += size + offset shift
-        _current->offset = corrected_offset + size;
-        return &(_current->buffer[corrected_offset - size]);
+        size_t pointer_offset;
+        ptrdiff_t distance;
+        if (relocated_distance(_relocations[i], &pointer_offset, &distance))
+            memcpy(packed_buffer + pointer_offset, &distance, sizeof(ptrdiff_t));
     }
 }
 
+ArenaPatch *ArenaAllocator::collect_patches(size_t *patch_count)
+{
+    ArenaPatch *patches = static_cast<ArenaPatch *>(malloc(_relocation_count * sizeof(ArenaPatch)));
+    if (!patches)
+        return nullptr;
+
+    *patch_count = 0;
+    for (size_t i = 0; i < _relocation_count; i++)
+    {
+        ArenaPatch &patch = patches[*patch_count];
+        if (relocated_distance(_relocations[i], &patch.offset, &patch.distance))
+            (*patch_count)++;
+    }
+
+    // Chunks are streamed in order, so patches are consumed in order
+    std::sort(patches, patches + *patch_count, [](const ArenaPatch &a, const ArenaPatch &b) { return a.offset < b.offset; });
+    return patches;
+}
+
+void ArenaAllocator::apply_patches(const ArenaPatch *patches, size_t patch_count, size_t *first_patch, unsigned char *chunk, size_t chunk_offset, size_t chunk_size)
+{
+    size_t chunk_end = chunk_offset + chunk_size;
+
+    // Skip patches that ended before this chunk, but not one that straddles its start
+    while (*first_patch < patch_count && patches[*first_patch].offset + sizeof(ptrdiff_t) <= chunk_offset)
+        (*first_patch)++;
+
+    for (size_t i = *first_patch; i < patch_count && patches[i].offset < chunk_end; i++)
+    {
+        const unsigned char *distance_bytes = reinterpret_cast<const unsigned char *>(&patches[i].distance);
+        size_t start = std::max(patches[i].offset, chunk_offset);
+        size_t end = std::min(patches[i].offset + sizeof(ptrdiff_t), chunk_end);
+        memcpy(chunk + (start - chunk_offset), distance_bytes + (start - patches[i].offset), end - start);
+    }
+}
+
+#if defined(ARENA_ALLOC_STATS)
+void ArenaAllocator::record_allocation(size_t size, size_t padding)
+{
+    _stats.payload_size += size;
+    _stats.padding_size += padding;
+    _stats.peak_size = std::max(_stats.peak_size, _total_size + size + padding);
+}
+
+ArenaStats ArenaAllocator::stats()
+{
+    return _stats;
+}
+#endif
+
+void ArenaAllocator::consolidate_blocks()
+{
+    size_t cycle_size = 0;
+    for (ArenaBlock *block = _head; block; block = block->next)
+        cycle_size += block->offset;
+
+    if (_smoothed_cycle_size == 0)
+        _smoothed_cycle_size = cycle_size;
+    else
+        _smoothed_cycle_size = static_cast<size_t>(_smoothed_cycle_size + (static_cast<double>(cycle_size) - _smoothed_cycle_size) * _growth_policy.consolidation_smoothing);
+
+    size_t consolidated_size = _smoothed_cycle_size;
+    if (_growth_policy.max_block_size && consolidated_size > _growth_policy.max_block_size)
+        consolidated_size = _growth_policy.max_block_size;
+    if (_current == _head || consolidated_size <= _head->capacity)
+        return; // Already one block, or the consolidated block wouldn't be any bigger than the first one
+
+    ArenaBlock *new_block = create_block(consolidated_size);
+    if (!new_block)
+        return; // Keep the chain, it still works
+    recycle_blocks(_head, _tail);
+    recycle_blocks(_cached_blocks, _cached_tail);
+    _cached_blocks = _cached_tail = nullptr;
+    _head = _current = _tail = new_block;
+}
+
 void ArenaAllocator::reset()
 {
+    run_destructors(nullptr);
+    release_large_blocks(nullptr);
+    if (_growth_policy.consolidate_on_reset)
+        consolidate_blocks();
+
     ArenaBlock *block = _head;
     while (block)
     {
-        block->offset = 0;
+        empty_block(block);
         block = block->next;
     }
     _current = _head;
     _total_size = 0;
+    _relocation_count = 0;
+#if defined(ARENA_ALLOC_STATS)
+    _stats.payload_size = 0;
+    _stats.padding_size = 0;
+    _stats.tail_waste = 0;
+#endif
 }
 
 void ArenaAllocator::free()
 {
-    ArenaBlock *block = _head->next;
-    while (block)
-    {
-        ArenaBlock *next = block->next;
-        std::free(block);
-        block = next;
-    }
-    _head->offset = 0;
+    run_destructors(nullptr);
+    release_large_blocks(nullptr);
+    recycle_blocks(_head->next, _tail);
+    recycle_blocks(_cached_blocks, _cached_tail);
+    _cached_blocks = _cached_tail = nullptr;
+    empty_block(_head);
     _head->next = nullptr;
-    _current = _head;
+    _current = _tail = _head;
     _total_size = 0;
+    _relocation_count = 0;
+#if defined(ARENA_ALLOC_STATS)
+    _stats.payload_size = 0;
+    _stats.padding_size = 0;
+    _stats.tail_waste = 0;
+#endif
+}
+
+bool ArenaAllocator::splice(ArenaAllocator &other)
+{
+    assert(&other != this);
+    if (other._max_alignment != _max_alignment || other._provider != _provider)
+        return false; // Blocks couldn't be released (or packed) correctly
+    if (other._total_size == 0 && !other._destructors && !other._relocation_count)
+        return true; // Nothing to move, so don't leave this arena's current block for an empty one
+
+    // Everything that can fail comes first, so a failed splice leaves both arenas as they were
+    if (_relocation_count + other._relocation_count > _relocation_capacity)
+    {
+        size_t new_capacity = _relocation_count + other._relocation_count;
+        unsigned char **new_relocations = static_cast<unsigned char **>(realloc(_relocations, new_capacity * sizeof(unsigned char *)));
+        if (!new_relocations)
+            return false; // Out of memory
+        _relocations = new_relocations;
+        _relocation_capacity = new_capacity;
+    }
+
+    if (other._large_blocks && !allocate_gap_padding())
+        return false; // Out of memory
+
+    // The other arena keeps its empty blocks past the current one, or gets a new first block
+    ArenaBlock *other_head = other._current->next;
+    if (!other_head)
+    {
+        other_head = other.take_cached_block(other._head->capacity);
+        if (!other_head)
+            other_head = other.create_block(other._head->capacity);
+        if (!other_head)
+            return false; // Out of memory
+        other._tail = other_head;
+    }
+
+    if (other._relocation_count)
+    {
+        memcpy(_relocations + _relocation_count, other._relocations, other._relocation_count * sizeof(unsigned char *));
+        _relocation_count += other._relocation_count;
+    }
+
+    // Pad the block being left, as in grow()
+    size_t padded_offset = (_current->offset + _max_alignment - 1) & ~(_max_alignment - 1);
+    size_t end_padding = padded_offset - _current->offset;
+    _current->offset = padded_offset;
+
+#if defined(ARENA_ALLOC_STATS)
+    size_t moved_block_count = 0; // Blocks are few, and this is only for the statistics
+    for (ArenaBlock *block = other._head; block != other._current->next; block = block->next)
+        moved_block_count++;
+    for (ArenaBlock *block = other._large_blocks; block; block = block->next)
+        moved_block_count++;
+
+    _stats.payload_size += other._stats.payload_size;
+    _stats.padding_size += end_padding + other._stats.padding_size;
+    _stats.tail_waste += other._stats.tail_waste;
+    _stats.block_count += moved_block_count;
+    _stats.peak_size = std::max(_stats.peak_size, _total_size + end_padding + other._total_size);
+    other._stats.payload_size = 0;
+    other._stats.padding_size = 0;
+    other._stats.tail_waste = 0;
+    other._stats.block_count -= moved_block_count;
+#endif
+
+    ArenaBlock *unused_blocks = _current->next;
+    _current->next = other._head;
+    other._current->next = unused_blocks;
+    if (!unused_blocks)
+        _tail = other._current;
+    _current = other._current;
+    _total_size += end_padding + other._total_size;
+
+    // The other arena's large blocks are newer, so they go after this one's
+    if (other._large_blocks)
+    {
+        if (_large_tail)
+            _large_tail->next = other._large_blocks;
+        else
+            _large_blocks = other._large_blocks;
+        _large_tail = other._large_tail;
+        _large_size += other._large_size;
+    }
+
+    // The other arena's objects are newer, so their destructors run first
+    if (other._destructors)
+    {
+        other._oldest_destructor->prev = _destructors;
+        if (!_destructors)
+            _oldest_destructor = other._oldest_destructor;
+        _destructors = other._destructors;
+    }
+
+    other._head = other._current = other_head;
+    other._total_size = 0;
+    other._large_blocks = other._large_tail = nullptr;
+    other._large_size = 0;
+    other._destructors = other._oldest_destructor = nullptr;
+    other._relocation_count = 0;
+    return true;
+}
+
+size_t ArenaAllocator::capacity()
+{
+    size_t total_capacity = 0;
+    for (ArenaBlock *block = _head; block; block = block->next)
+        total_capacity += block->capacity;
+    for (ArenaBlock *block = _cached_blocks; block; block = block->next)
+        total_capacity += block->capacity;
+    return total_capacity;
+}
+
+void ArenaAllocator::release_block_pages(ArenaBlock *block)
+{
+#if defined(__linux__)
+    // Other systems don't promise that MADV_DONTNEED pages come back zeroed
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (block->dirty_size <= block->offset)
+        return;
+
+    uintptr_t start = (reinterpret_cast<uintptr_t>(block->buffer + block->offset) + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(block->buffer + block->dirty_size) & ~(uintptr_t)(page_size - 1);
+    if (start >= end || madvise(reinterpret_cast<void *>(start), end - start, MADV_DONTNEED) != 0)
+        return;
+
+    // Clear the partial page after the released ones, so everything from start on is clean
+    unsigned char *dirty_end = block->buffer + block->dirty_size;
+    memset(reinterpret_cast<unsigned char *>(end), 0, dirty_end - reinterpret_cast<unsigned char *>(end));
+    block->dirty_size = reinterpret_cast<unsigned char *>(start) - block->buffer;
+#else
+    (void)block;
+#endif
+}
+
+void ArenaAllocator::release_pages()
+{
+    for (ArenaBlock *block = _head; block; block = block->next)
+        release_block_pages(block);
+    for (ArenaBlock *block = _cached_blocks; block; block = block->next)
+        release_block_pages(block);
 }
 
 void *ArenaAllocator::pack(size_t *packed_size)
 {
-    if (_total_size == 0)
+    size_t total_size = prepare_packed_layout();
+    if (total_size == 0)
         return nullptr;
 
-    unsigned char *packed_buffer = static_cast<unsigned char *>(malloc(_total_size));
-    *packed_size = _total_size;
+    unsigned char *packed_buffer = static_cast<unsigned char *>(malloc(total_size));
+    *packed_size = total_size;
 
-    ArenaBlock *block = _head;
+    ArenaBlock *block = first_packed_block();
     unsigned char *packed_buffer_ptr = packed_buffer;
+    bool streaming = total_size >= STREAM_COPY_THRESHOLD; // Nothing will read the packed copy soon, so don't cache it
     while (block)
     {
-        memcpy(packed_buffer_ptr, block->buffer, block->offset);
+        if (streaming)
+            stream_copy(packed_buffer_ptr, block->buffer, block->offset);
+        else
+            memcpy(packed_buffer_ptr, block->buffer, block->offset);
         packed_buffer_ptr += block->offset;
-        block = block->next;
+        block = next_packed_block(block);
     }
 
+    apply_relocations(packed_buffer);
     return packed_buffer;
 }
 
+void ArenaAllocator::pack_slice(unsigned char *packed_buffer, size_t slice_start, size_t slice_end)
+{
+    size_t block_start = 0;
+    ArenaBlock *block = first_packed_block();
+    while (block && block_start < slice_end)
+    {
+        size_t block_end = block_start + block->offset;
+        if (block_end > slice_start)
+        {
+            size_t copy_start = std::max(block_start, slice_start);
+            size_t copy_end = std::min(block_end, slice_end);
+            if (slice_end - slice_start >= STREAM_COPY_THRESHOLD)
+                stream_copy(packed_buffer + copy_start, block->buffer + (copy_start - block_start), copy_end - copy_start);
+            else
+                memcpy(packed_buffer + copy_start, block->buffer + (copy_start - block_start), copy_end - copy_start);
+        }
+        block_start = block_end;
+        block = next_packed_block(block);
+    }
+}
+
+void *ArenaAllocator::pack_parallel(size_t *packed_size, unsigned thread_count)
+{
+    size_t total_size = prepare_packed_layout();
+    if (total_size == 0)
+        return nullptr;
+
+    unsigned char *packed_buffer = static_cast<unsigned char *>(malloc(total_size));
+    if (!packed_buffer)
+        return nullptr;
+    *packed_size = total_size;
+
+    size_t max_thread_count = std::max<size_t>(total_size / ARENA_PARALLEL_PACK_MIN_SLICE, 1);
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    if (thread_count > max_thread_count)
+        thread_count = static_cast<unsigned>(max_thread_count);
+
+    // The calling thread takes the last slice
+    std::thread *threads = new std::thread[thread_count - 1];
+    for (unsigned i = 0; i < thread_count - 1; i++)
+    {
+        size_t slice_start = total_size / thread_count * i;
+        size_t slice_end = total_size / thread_count * (i + 1);
+        threads[i] = std::thread(&ArenaAllocator::pack_slice, this, packed_buffer, slice_start, slice_end);
+    }
+    pack_slice(packed_buffer, total_size / thread_count * (thread_count - 1), total_size);
+    for (unsigned i = 0; i < thread_count - 1; i++)
+        threads[i].join();
+    delete[] threads;
+
+    apply_relocations(packed_buffer);
+    return packed_buffer;
+}
+
+template <typename Writer>
+bool ArenaAllocator::pack_to(Writer writer, size_t chunk_size)
+{
+    assert(chunk_size > 0);
+
+    prepare_packed_layout();
+    ArenaPatch *patches = nullptr;
+    size_t patch_count = 0;
+    size_t first_patch = 0;
+    unsigned char *staging_buffer = nullptr;
+    if (_relocation_count)
+    {
+        patches = collect_patches(&patch_count);
+        staging_buffer = static_cast<unsigned char *>(malloc(chunk_size));
+        if (!patches || !staging_buffer)
+        {
+            std::free(patches);
+            std::free(staging_buffer);
+            return false; // Out of memory
+        }
+    }
+
+    bool written = true;
+    size_t packed_position = 0;
+    for (ArenaBlock *block = first_packed_block(); block && written; block = next_packed_block(block))
+    {
+        for (size_t block_position = 0; block_position < block->offset && written; block_position += chunk_size)
+        {
+            size_t size = std::min(chunk_size, block->offset - block_position);
+            const unsigned char *chunk = block->buffer + block_position;
+            if (staging_buffer)
+            {
+                memcpy(staging_buffer, chunk, size);
+                apply_patches(patches, patch_count, &first_patch, staging_buffer, packed_position, size);
+                chunk = staging_buffer;
+            }
+            written = writer(static_cast<const void *>(chunk), size);
+            packed_position += size;
+        }
+    }
+
+    std::free(patches);
+    std::free(staging_buffer);
+    return written;
+}
+
+size_t ArenaAllocator::pack_iovec(struct iovec *iovecs, size_t max_count)
+{
+    size_t count = 0;
+    prepare_packed_layout();
+    for (ArenaBlock *block = first_packed_block(); block; block = next_packed_block(block))
+    {
+        if (block->offset)
+        {
+            if (count < max_count)
+            {
+                iovecs[count].iov_base = block->buffer;
+                iovecs[count].iov_len = block->offset;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+ArenaMmapProvider::ArenaMmapProvider()
+{
+    _huge_pages = false;
+}
+
+ArenaMmapProvider::ArenaMmapProvider(bool huge_pages)
+{
+    _huge_pages = huge_pages;
+}
+
+void *ArenaMmapProvider::allocate_block(size_t size)
+{
+#if defined(_WIN32)
+    (void)_huge_pages; // Large pages need a privilege on Windows, so they aren't attempted
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+        return nullptr;
+#if defined(MADV_HUGEPAGE)
+    if (_huge_pages)
+        madvise(block, size, MADV_HUGEPAGE);
+#endif
+    return block;
+#endif
+}
+
+bool ArenaMmapProvider::zeroes_blocks()
+{
+    return true; // Fresh pages from the OS
+}
+
+void ArenaMmapProvider::release_block(void *block, size_t size)
+{
+#if defined(_WIN32)
+    (void)size;
+    VirtualFree(block, 0, MEM_RELEASE);
+#else
+    munmap(block, size);
+#endif
+}
+
+bool ArenaAllocator::save(const char *path)
+{
+    if (_max_alignment > ARENA_IMAGE_PAGE_SIZE)
+        return false; // load() couldn't honor it, since mappings are only guaranteed to be page-aligned
+
+    ArenaImageHeader header;
+    header.magic = ARENA_IMAGE_MAGIC;
+    header.version = ARENA_IMAGE_VERSION;
+    header.pointer_size = sizeof(ptrdiff_t);
+    header.alignment = _max_alignment;
+    header.data_offset = ARENA_IMAGE_PAGE_SIZE;
+    header.data_size = prepare_packed_layout();
+
+    FILE *file = fopen(path, "wb");
+    bool written = file != nullptr;
+    if (written)
+    {
+        written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        // Zero-fill up to the data offset, one page at a time
+        static const unsigned char zeros[ARENA_IMAGE_PAGE_SIZE] = {};
+        for (uint64_t position = sizeof(header); written && position < header.data_offset; position += sizeof(zeros))
+        {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(sizeof(zeros), header.data_offset - position));
+            written = fwrite(zeros, 1, count, file) == count;
+        }
+
+        if (written)
+            written = pack_to([file](const void *data, size_t size) { return fwrite(data, 1, size, file) == size; }, ARENA_SAVE_CHUNK_SIZE);
+        written = fclose(file) == 0 && written;
+    }
+
+    return written;
+}
+
+ArenaImage::ArenaImage()
+{
+    _mapping = nullptr;
+    _mapping_size = 0;
+    _data = nullptr;
+    _size = 0;
+}
+
+ArenaImage::~ArenaImage()
+{
+    unload();
+}
+
+bool ArenaImage::load(const char *path, bool copy_on_write)
+{
+    unload();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    HANDLE file_mapping = nullptr;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart >= (LONGLONG)sizeof(ArenaImageHeader))
+        file_mapping = CreateFileMappingA(file, nullptr, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+    if (file_mapping)
+    {
+        _mapping = MapViewOfFile(file_mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(file_mapping);
+    }
+    CloseHandle(file);
+    if (!_mapping)
+        return false;
+    _mapping_size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat file_stat;
+    void *mapping = MAP_FAILED;
+    if (fstat(file, &file_stat) == 0 && file_stat.st_size >= (off_t)sizeof(ArenaImageHeader))
+        mapping = mmap(nullptr, file_stat.st_size, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // The mapping keeps the file alive
+    if (mapping == MAP_FAILED)
+        return false;
+    _mapping = mapping;
+    _mapping_size = file_stat.st_size;
+#endif
+
+    ArenaImageHeader header;
+    memcpy(&header, _mapping, sizeof(header));
+    bool valid = header.magic == ARENA_IMAGE_MAGIC
+        && header.version == ARENA_IMAGE_VERSION
+        && header.pointer_size == sizeof(ptrdiff_t)
+        && header.alignment != 0 && (header.alignment & (header.alignment - 1)) == 0
+        && header.alignment <= ARENA_IMAGE_PAGE_SIZE // Mappings are only guaranteed to be page-aligned
+        && header.data_offset % header.alignment == 0
+        && header.data_offset <= _mapping_size
+        && header.data_size <= _mapping_size - header.data_offset;
+    if (!valid)
+    {
+        unload();
+        return false;
+    }
+
+    _data = static_cast<unsigned char *>(_mapping) + header.data_offset;
+    _size = static_cast<size_t>(header.data_size);
+    return true;
+}
+
+void ArenaImage::unload()
+{
+    if (_mapping)
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(_mapping);
+#else
+        munmap(_mapping, _mapping_size);
+#endif
+    }
+    _mapping = nullptr;
+    _mapping_size = 0;
+    _data = nullptr;
+    _size = 0;
+}
+
+void *ArenaImage::data()
+{
+    return _data;
+}
+
+size_t ArenaImage::size()
+{
+    return _size;
+}
+
 #endif
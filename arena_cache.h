@@ -0,0 +1,140 @@
+/*
+    The arena cache recycles arena allocators, for servers that give every request its own arena.
+
+    Creating an arena per request and destroying it afterwards costs a malloc() and free() of the first
+    block every time, plus the growth of the chain back up to what a typical request needs, since all of the
+    blocks (and the cache of spare blocks) go away with the arena. acquire() instead hands out an arena that
+    was released earlier, reset and with its blocks intact, so a request that fits in what its predecessors
+    used allocates no memory at all. Only when the cache is empty is a new arena created, with the capacity,
+    alignment, growth policy and block provider the cache was constructed with (nullptr is returned if that
+    fails).
+
+    release() resets an arena and puts it back. Keeping a warmed-up arena is the point, but keeping one that a
+    single huge request grew to gigabytes is not, so an arena whose capacity is over trim_capacity is freed
+    first (which releases every block but the first), and destroyed if even that isn't enough. At most
+    max_cached arenas are kept; the rest are destroyed on release. trim() destroys every cached arena, for
+    when the server goes idle.
+
+    acquire() and release() may be called from any thread. They're guarded by a mutex, but the critical
+    section is just a push or pop on an array, so contention is low even with many workers. Resetting,
+    freeing and destroying arenas all happen outside of the lock. The arenas themselves aren't thread-safe,
+    so each one must only be used by one thread at a time, as usual.
+*/
+
+#ifndef ARENA_CACHE_H
+#define ARENA_CACHE_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <mutex>
+
+#include "arena_alloc.h"
+
+class ArenaCache
+{
+    private:
+        size_t _arena_capacity;
+        size_t _max_alignment;
+        ArenaGrowthPolicy _growth_policy;
+        ArenaBlockProvider *_provider;
+        size_t _trim_capacity;
+        size_t _max_cached;
+        ArenaAllocator **_arenas; // Cached arenas, most recently released last
+        size_t _arena_count;
+        std::mutex _mutex;
+
+    public:
+        ArenaCache(size_t arena_capacity, size_t max_cached, size_t trim_capacity);
+        ArenaCache(size_t arena_capacity, size_t max_alignment, const ArenaGrowthPolicy &growth_policy, ArenaBlockProvider *provider, size_t max_cached, size_t trim_capacity);
+        ~ArenaCache();
+        ArenaAllocator *acquire();
+        void release(ArenaAllocator *arena);
+        void trim();
+};
+
+ArenaCache::ArenaCache(size_t arena_capacity, size_t max_cached, size_t trim_capacity)
+    : ArenaCache(arena_capacity, alignof(max_align_t), ArenaGrowthPolicy(), nullptr, max_cached, trim_capacity)
+{
+}
+
+ArenaCache::ArenaCache(size_t arena_capacity, size_t max_alignment, const ArenaGrowthPolicy &growth_policy, ArenaBlockProvider *provider, size_t max_cached, size_t trim_capacity)
+{
+    _arena_capacity = arena_capacity;
+    _max_alignment = max_alignment;
+    _growth_policy = growth_policy;
+    _provider = provider;
+    _trim_capacity = trim_capacity;
+    _max_cached = max_cached;
+    _arenas = static_cast<ArenaAllocator **>(malloc(max_cached * sizeof(ArenaAllocator *)));
+    if (!_arenas)
+        _max_cached = 0; // Still works, just without caching
+    _arena_count = 0;
+}
+
+ArenaCache::~ArenaCache()
+{
+    trim();
+    std::free(_arenas);
+}
+
+ArenaAllocator *ArenaCache::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_arena_count)
+            return _arenas[--_arena_count]; // The most recently used one is the likeliest to still be in the cache
+    }
+
+    return new (std::nothrow) ArenaAllocator(_arena_capacity, _max_alignment, _growth_policy, _provider);
+}
+
+void ArenaCache::release(ArenaAllocator *arena)
+{
+    arena->reset();
+    if (arena->capacity() > _trim_capacity)
+    {
+        arena->free();
+        if (arena->capacity() > _trim_capacity)
+        {
+            delete arena;
+            return;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_arena_count < _max_cached)
+        {
+            _arenas[_arena_count++] = arena;
+            return;
+        }
+    }
+
+    delete arena; // Cache full
+}
+
+void ArenaCache::trim()
+{
+    ArenaAllocator **arenas;
+    size_t arena_count;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        arena_count = _arena_count;
+        _arena_count = 0;
+        if (arena_count == 0)
+            return;
+
+        // Swap in a fresh array so the arenas can be destroyed outside of the lock
+        arenas = _arenas;
+        _arenas = static_cast<ArenaAllocator **>(malloc(_max_cached * sizeof(ArenaAllocator *)));
+        if (!_arenas)
+            _max_cached = 0;
+    }
+
+    for (size_t i = 0; i < arena_count; i++)
+        delete arenas[i];
+    std::free(arenas);
+}
+
+#endif
@@ -0,0 +1,521 @@
+/*
+    The arena containers are a vector, a string and a hash map that take their memory from an arena allocator
+    or a linear allocator, so data structures built during a cycle can live in the arena with everything else.
+
+    They're templates over the allocator, which only needs alloc_align() and grow_in_place(), so they work
+    with both ArenaAllocator and LinearAllocator (and this file doesn't include either). The containers never
+    free anything: memory left behind by growth stays in the allocator until it's reset, like everything
+    else in it, and there are no destructors to run. That also means the elements (and the map's keys and
+    values) must be trivially copyable, since they're moved with memcpy() and never destroyed. Copying a
+    container would alias its storage, so containers can't be copied.
+
+    Growth is where an arena container differs most from its std counterpart. Instead of allocating a new
+    buffer, copying and freeing the old one, a vector or string first asks the allocator to grow_in_place(),
+    which succeeds whenever its buffer is the allocator's most recent allocation and there's room after it.
+    A container built without interleaved allocations, which is the usual case for the one being filled in
+    a loop, therefore grows without ever copying. Otherwise, the new buffer is allocated normally and the old
+    one is abandoned, which wastes at most as much as the final buffer (capacities double), so it's worth
+    calling reserve() when the size is known.
+
+    The hash map uses open addressing with linear probing, in power-of-two tables kept at most 3/4 full. Each
+    slot has a control byte, zero for an empty slot or the top bits of the key's hash otherwise, which are
+    compared before the key, so a probe only touches the keys that are very likely to match, and scans the
+    control bytes (which are kept apart from the slots) otherwise. The hash is mixed before use, since
+    std::hash is the identity for integers with common standard libraries, and that would defeat the
+    power-of-two masking. erase() shifts the following entries back instead of leaving tombstones, so
+    lookups never slow down after many erases. A table can't grow in place (every entry moves), so the map
+    always rehashes into a new table.
+
+    Operations that allocate return false or nullptr when the allocator is out of space, in which case the
+    container is left as it was.
+*/
+
+#ifndef ARENA_CONTAINERS_H
+#define ARENA_CONTAINERS_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <new>
+#include <functional>
+#include <type_traits>
+
+constexpr size_t ARENA_CONTAINER_MIN_CAPACITY = 8;
+
+// Shared by the vector and the string, which only differ in element type and the string's terminator
+template <typename Allocator>
+bool arena_grow_buffer(Allocator *allocator, unsigned char **data, size_t *capacity, size_t min_capacity, size_t used_size, size_t element_size, size_t alignment)
+{
+    size_t new_capacity = *capacity * 2;
+    if (new_capacity < min_capacity)
+        new_capacity = min_capacity;
+    if (new_capacity < ARENA_CONTAINER_MIN_CAPACITY)
+        new_capacity = ARENA_CONTAINER_MIN_CAPACITY;
+    if (new_capacity > SIZE_MAX / element_size)
+        return false; // Overflow
+
+    if (*data && allocator->grow_in_place(*data, *capacity * element_size, new_capacity * element_size))
+    {
+        *capacity = new_capacity;
+        return true;
+    }
+
+    unsigned char *new_data = static_cast<unsigned char *>(allocator->alloc_align(new_capacity * element_size, alignment));
+    if (!new_data)
+        return false; // Out of space
+    if (used_size)
+        memcpy(new_data, *data, used_size * element_size);
+    *data = new_data;
+    *capacity = new_capacity;
+    return true;
+}
+
+template <typename T, typename Allocator>
+class ArenaVector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Elements are moved with memcpy() and never destroyed");
+
+    private:
+        Allocator *_allocator;
+        T *_data;
+        size_t _size;
+        size_t _capacity;
+
+    public:
+        ArenaVector(Allocator &allocator);
+        ArenaVector(const ArenaVector &other) = delete;
+        ArenaVector &operator=(const ArenaVector &other) = delete;
+        bool reserve(size_t capacity);
+        bool resize(size_t size);
+        bool push_back(const T &value);
+        void pop_back();
+        void clear();
+        T &operator[](size_t index);
+        const T &operator[](size_t index) const;
+        T *data();
+        T *begin();
+        T *end();
+        size_t size() const;
+        size_t capacity() const;
+        bool empty() const;
+};
+
+template <typename T, typename Allocator>
+ArenaVector<T, Allocator>::ArenaVector(Allocator &allocator)
+{
+    _allocator = &allocator;
+    _data = nullptr;
+    _size = 0;
+    _capacity = 0;
+}
+
+template <typename T, typename Allocator>
+bool ArenaVector<T, Allocator>::reserve(size_t capacity)
+{
+    if (capacity <= _capacity)
+        return true;
+
+    unsigned char *data = reinterpret_cast<unsigned char *>(_data);
+    if (!arena_grow_buffer(_allocator, &data, &_capacity, capacity, _size, sizeof(T), alignof(T)))
+        return false;
+    _data = reinterpret_cast<T *>(data);
+    return true;
+}
+
+template <typename T, typename Allocator>
+bool ArenaVector<T, Allocator>::resize(size_t size)
+{
+    if (!reserve(size))
+        return false;
+    for (size_t i = _size; i < size; i++)
+        new (&_data[i]) T();
+    _size = size;
+    return true;
+}
+
+template <typename T, typename Allocator>
+bool ArenaVector<T, Allocator>::push_back(const T &value)
+{
+    if (_size == _capacity && !reserve(_size + 1))
+        return false;
+    new (&_data[_size++]) T(value);
+    return true;
+}
+
+template <typename T, typename Allocator>
+void ArenaVector<T, Allocator>::pop_back()
+{
+    assert(_size > 0);
+    _size--;
+}
+
+template <typename T, typename Allocator>
+void ArenaVector<T, Allocator>::clear()
+{
+    _size = 0; // The buffer is kept
+}
+
+template <typename T, typename Allocator>
+T &ArenaVector<T, Allocator>::operator[](size_t index)
+{
+    assert(index < _size);
+    return _data[index];
+}
+
+template <typename T, typename Allocator>
+const T &ArenaVector<T, Allocator>::operator[](size_t index) const
+{
+    assert(index < _size);
+    return _data[index];
+}
+
+template <typename T, typename Allocator>
+T *ArenaVector<T, Allocator>::data()
+{
+    return _data;
+}
+
+template <typename T, typename Allocator>
+T *ArenaVector<T, Allocator>::begin()
+{
+    return _data;
+}
+
+template <typename T, typename Allocator>
+T *ArenaVector<T, Allocator>::end()
+{
+    return _data + _size;
+}
+
+template <typename T, typename Allocator>
+size_t ArenaVector<T, Allocator>::size() const
+{
+    return _size;
+}
+
+template <typename T, typename Allocator>
+size_t ArenaVector<T, Allocator>::capacity() const
+{
+    return _capacity;
+}
+
+template <typename T, typename Allocator>
+bool ArenaVector<T, Allocator>::empty() const
+{
+    return _size == 0;
+}
+
+template <typename Allocator>
+class ArenaString
+{
+    private:
+        Allocator *_allocator;
+        char *_data; // Always null-terminated once allocated
+        size_t _size;
+        size_t _capacity; // Including the terminator
+
+    public:
+        ArenaString(Allocator &allocator);
+        ArenaString(const ArenaString &other) = delete;
+        ArenaString &operator=(const ArenaString &other) = delete;
+        bool reserve(size_t size);
+        bool append(const char *text, size_t length);
+        bool append(const char *text);
+        bool push_back(char character);
+        void clear();
+        char &operator[](size_t index);
+        const char *c_str() const;
+        char *data();
+        size_t size() const;
+        bool empty() const;
+};
+
+template <typename Allocator>
+ArenaString<Allocator>::ArenaString(Allocator &allocator)
+{
+    _allocator = &allocator;
+    _data = nullptr;
+    _size = 0;
+    _capacity = 0;
+}
+
+template <typename Allocator>
+bool ArenaString<Allocator>::reserve(size_t size)
+{
+    if (size < _capacity)
+        return true;
+
+    unsigned char *data = reinterpret_cast<unsigned char *>(_data);
+    if (!arena_grow_buffer(_allocator, &data, &_capacity, size + 1, _size, 1, 1))
+        return false;
+    _data = reinterpret_cast<char *>(data);
+    _data[_size] = '\0';
+    return true;
+}
+
+template <typename Allocator>
+bool ArenaString<Allocator>::append(const char *text, size_t length)
+{
+    if (!reserve(_size + length))
+        return false;
+    memcpy(_data + _size, text, length);
+    _size += length;
+    _data[_size] = '\0';
+    return true;
+}
+
+template <typename Allocator>
+bool ArenaString<Allocator>::append(const char *text)
+{
+    return append(text, strlen(text));
+}
+
+template <typename Allocator>
+bool ArenaString<Allocator>::push_back(char character)
+{
+    return append(&character, 1);
+}
+
+template <typename Allocator>
+void ArenaString<Allocator>::clear()
+{
+    _size = 0;
+    if (_data)
+        _data[0] = '\0';
+}
+
+template <typename Allocator>
+char &ArenaString<Allocator>::operator[](size_t index)
+{
+    assert(index < _size);
+    return _data[index];
+}
+
+template <typename Allocator>
+const char *ArenaString<Allocator>::c_str() const
+{
+    return _data ? _data : "";
+}
+
+template <typename Allocator>
+char *ArenaString<Allocator>::data()
+{
+    return _data;
+}
+
+template <typename Allocator>
+size_t ArenaString<Allocator>::size() const
+{
+    return _size;
+}
+
+template <typename Allocator>
+bool ArenaString<Allocator>::empty() const
+{
+    return _size == 0;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class ArenaHashMap
+{
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "Entries are moved with memcpy() and never destroyed");
+
+    private:
+        static const unsigned char EMPTY = 0;
+
+        struct Slot
+        {
+            K key;
+            V value;
+        };
+
+        Allocator *_allocator;
+        unsigned char *_control; // EMPTY, or 0x80 | the top 7 bits of the mixed hash
+        Slot *_slots;
+        size_t _size;
+        size_t _capacity; // A power of two, or 0 before the first insertion
+        Hash _hash;
+        KeyEqual _key_equal;
+
+        uint64_t mixed_hash(const K &key) const;
+        size_t find_index(const K &key) const;
+        bool rehash(size_t capacity);
+
+    public:
+        ArenaHashMap(Allocator &allocator);
+        ArenaHashMap(const ArenaHashMap &other) = delete;
+        ArenaHashMap &operator=(const ArenaHashMap &other) = delete;
+        bool reserve(size_t count);
+        V *insert(const K &key, const V &value);
+        V *find(const K &key);
+        bool erase(const K &key);
+        void clear();
+        template <typename Function>
+        void for_each(Function function);
+        size_t size() const;
+        bool empty() const;
+};
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::ArenaHashMap(Allocator &allocator)
+{
+    _allocator = &allocator;
+    _control = nullptr;
+    _slots = nullptr;
+    _size = 0;
+    _capacity = 0;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+uint64_t ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::mixed_hash(const K &key) const
+{
+    // Fibonacci hashing spreads the low bits upward, and the shift brings them back down for the mask
+    uint64_t hash = static_cast<uint64_t>(_hash(key)) * 0x9e3779b97f4a7c15ull;
+    return hash ^ (hash >> 32);
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+size_t ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::find_index(const K &key) const
+{
+    // Returns the key's slot, or the empty slot where it would go
+    uint64_t hash = mixed_hash(key);
+    unsigned char tag = static_cast<unsigned char>(0x80 | (hash >> 57));
+    size_t mask = _capacity - 1;
+    size_t index = static_cast<size_t>(hash) & mask;
+    while (_control[index] != EMPTY)
+    {
+        if (_control[index] == tag && _key_equal(_slots[index].key, key))
+            return index;
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+bool ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::rehash(size_t capacity)
+{
+    if (capacity > SIZE_MAX / sizeof(Slot))
+        return false; // Overflow
+
+    unsigned char *new_control = static_cast<unsigned char *>(_allocator->alloc_align(capacity, 1));
+    Slot *new_slots = static_cast<Slot *>(_allocator->alloc_align(capacity * sizeof(Slot), alignof(Slot)));
+    if (!new_control || !new_slots)
+        return false; // Out of space
+    memset(new_control, EMPTY, capacity);
+
+    unsigned char *old_control = _control;
+    Slot *old_slots = _slots;
+    size_t old_capacity = _capacity;
+    _control = new_control;
+    _slots = new_slots;
+    _capacity = capacity;
+
+    // Keys are unique, so each one just goes to the first empty slot of its probe sequence
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_control[i] == EMPTY)
+            continue;
+        size_t index = find_index(old_slots[i].key);
+        _control[index] = old_control[i];
+        memcpy(&_slots[index], &old_slots[i], sizeof(Slot));
+    }
+    return true;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+bool ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::reserve(size_t count)
+{
+    size_t capacity = _capacity ? _capacity : 16;
+    while (count > capacity / 4 * 3)
+        capacity *= 2;
+    return capacity == _capacity || rehash(capacity);
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+V *ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::insert(const K &key, const V &value)
+{
+    if (!reserve(_size + 1))
+        return nullptr;
+
+    size_t index = find_index(key);
+    if (_control[index] == EMPTY)
+    {
+        _control[index] = static_cast<unsigned char>(0x80 | (mixed_hash(key) >> 57));
+        new (&_slots[index].key) K(key);
+        _size++;
+    }
+    new (&_slots[index].value) V(value); // Trivially copyable, so overwriting needs no destruction
+    return &_slots[index].value;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+V *ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::find(const K &key)
+{
+    if (_size == 0)
+        return nullptr;
+
+    size_t index = find_index(key);
+    return _control[index] == EMPTY ? nullptr : &_slots[index].value;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+bool ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::erase(const K &key)
+{
+    if (_size == 0)
+        return false;
+
+    size_t hole = find_index(key);
+    if (_control[hole] == EMPTY)
+        return false;
+
+    // Shift back every following entry whose probe sequence passes through the hole
+    size_t mask = _capacity - 1;
+    for (size_t index = (hole + 1) & mask; _control[index] != EMPTY; index = (index + 1) & mask)
+    {
+        size_t home = static_cast<size_t>(mixed_hash(_slots[index].key)) & mask;
+        if (((index - home) & mask) >= ((index - hole) & mask))
+        {
+            _control[hole] = _control[index];
+            memcpy(&_slots[hole], &_slots[index], sizeof(Slot));
+            hole = index;
+        }
+    }
+    _control[hole] = EMPTY;
+    _size--;
+    return true;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+void ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::clear()
+{
+    if (_control)
+        memset(_control, EMPTY, _capacity); // The table is kept
+    _size = 0;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+template <typename Function>
+void ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::for_each(Function function)
+{
+    for (size_t i = 0; i < _capacity; i++)
+    {
+        if (_control[i] != EMPTY)
+            function(static_cast<const K &>(_slots[i].key), _slots[i].value);
+    }
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+size_t ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::size() const
+{
+    return _size;
+}
+
+template <typename K, typename V, typename Allocator, typename Hash, typename KeyEqual>
+bool ArenaHashMap<K, V, Allocator, Hash, KeyEqual>::empty() const
+{
+    return _size == 0;
+}
+
+#endif
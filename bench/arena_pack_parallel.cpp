@@ -0,0 +1,89 @@
+/*
+    Measures how pack_parallel() scales with the thread count (arena_alloc.h).
+
+    An arena is filled with a few hundred megabytes spread over many blocks, then packed with pack() and
+    with pack_parallel() at 1, 2, 4, ... threads, up to twice the hardware concurrency. Each packed buffer
+    is checked against pack()'s. The times include the page faults on the freshly malloc()ed destination,
+    which a real caller pays as well, and which are a large part of the cost for a single pass.
+
+    Build: g++ -std=c++11 -O2 -I.. arena_pack_parallel.cpp -o arena_pack_parallel -pthread
+    Usage: arena_pack_parallel [arena size in MiB] [block size in MiB]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include "arena_alloc.h"
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr int REPEAT_COUNT = 3;
+
+static void report(const char *name, unsigned thread_count, double seconds, size_t size, double baseline)
+{
+    printf("%-14s %3u threads %8.1f ms %6.2f GB/s %5.2fx\n", name, thread_count, seconds * 1e3, size / seconds / 1e9,
+           baseline / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    size_t arena_size = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 512) * 1024 * 1024;
+    size_t block_size = (argc > 2 ? strtoull(argv[2], nullptr, 10) : 16) * 1024 * 1024;
+    size_t allocation_size = 64 * 1024;
+
+    ArenaAllocator arena(block_size);
+    for (size_t filled = 0; filled < arena_size; filled += allocation_size)
+    {
+        unsigned char *allocation = static_cast<unsigned char *>(arena.alloc(allocation_size));
+        if (!allocation)
+        {
+            printf("Out of memory after %zu bytes\n", filled);
+            return 1;
+        }
+        memset(allocation, static_cast<int>(filled / allocation_size), allocation_size);
+    }
+
+    unsigned hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    printf("%zu MiB in %zu MiB blocks, %u hardware threads, best of %d\n", arena_size >> 20, block_size >> 20,
+           hardware_threads, REPEAT_COUNT);
+
+    size_t reference_size = 0;
+    void *reference = nullptr;
+    double pack_time = 0;
+    for (int i = 0; i < REPEAT_COUNT; i++)
+    {
+        std::free(reference);
+        Clock::time_point start = Clock::now();
+        reference = arena.pack(&reference_size);
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (i == 0 || elapsed < pack_time)
+            pack_time = elapsed;
+    }
+    report("pack", 1, pack_time, reference_size, pack_time);
+
+    for (unsigned thread_count = 1; thread_count <= hardware_threads * 2; thread_count *= 2)
+    {
+        double best_time = 0;
+        for (int i = 0; i < REPEAT_COUNT; i++)
+        {
+            size_t packed_size = 0;
+            Clock::time_point start = Clock::now();
+            void *packed = arena.pack_parallel(&packed_size, thread_count);
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            if (i == 0 || elapsed < best_time)
+                best_time = elapsed;
+            if (packed_size != reference_size || memcmp(packed, reference, packed_size) != 0)
+            {
+                printf("pack_parallel(%u) output differs from pack()\n", thread_count);
+                return 1;
+            }
+            std::free(packed);
+        }
+        report("pack_parallel", thread_count, best_time, reference_size, pack_time);
+    }
+
+    std::free(reference);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+    Measures conflict misses between pools walked in lockstep, with and without cache coloring (pool_alloc.h).
+
+    Each pool has page-sized chunks, so every chunk starts at the same offset within a page, and the
+    benchmark walks one cache line per pool round-robin as a chain of dependent loads (chunk 0 of pool 0,
+    chunk 0 of pool 1, ...), the way code updating the same entity across several component pools would.
+    That working set is tiny, but without coloring every line maps to the same cache set, so once there are
+    more pools than the cache has ways, each load misses L1. The pools normally get consecutive colors;
+    for the uncolored run, seven throwaway pools are created after each one, which wraps the color counter
+    around so every measured pool gets the same color. All the pools are created before any is destroyed,
+    since glibc raises its mmap threshold after a large block is freed, and later buffers would then come
+    from the heap at arbitrary offsets instead of starting on page boundaries.
+
+    Build: g++ -std=c++11 -O2 -I.. pool_cache_coloring.cpp -o pool_cache_coloring
+    Usage: pool_cache_coloring [chunk size]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include "pool_alloc.h"
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr size_t CHUNK_COUNT = 64;
+constexpr size_t STEP_COUNT = 50 * 1000 * 1000;
+
+struct Pools
+{
+    std::vector<PoolAllocator *> pools;
+    std::vector<void *> hot_lines;
+
+    Pools(size_t pool_count, size_t chunk_size, bool colored)
+    {
+        for (size_t i = 0; i < pool_count; i++)
+        {
+            pools.push_back(new PoolAllocator(CHUNK_COUNT, chunk_size));
+            hot_lines.push_back(pools.back()->alloc());
+            if (!colored)
+            {
+                for (size_t j = 0; j < POOL_CACHE_COLORS - 1; j++)
+                    PoolAllocator throwaway(1, chunk_size);
+            }
+        }
+
+        // Each pool's hot line points at the next pool's, so the walk is a chain of dependent loads
+        for (size_t i = 0; i < pool_count; i++)
+            *static_cast<void **>(hot_lines[i]) = hot_lines[(i + 1) % pool_count];
+    }
+
+    ~Pools()
+    {
+        for (size_t i = 0; i < pools.size(); i++)
+            delete pools[i];
+    }
+
+    size_t distinct_sets() const
+    {
+        std::vector<bool> seen(4096 / POOL_CACHE_LINE_SIZE);
+        size_t count = 0;
+        for (size_t i = 0; i < hot_lines.size(); i++)
+        {
+            size_t set = (reinterpret_cast<uintptr_t>(hot_lines[i]) & 4095) / POOL_CACHE_LINE_SIZE;
+            if (!seen[set])
+                count++;
+            seen[set] = true;
+        }
+        return count;
+    }
+
+    double walk() const
+    {
+        void *line = hot_lines[0];
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < STEP_COUNT; i++)
+            line = *static_cast<void **>(line);
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (!line)
+            printf("unreachable\n"); // Keeps the walk from being optimized away
+        return elapsed * 1e9 / STEP_COUNT;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    size_t chunk_size = argc > 1 ? strtoull(argv[1], nullptr, 10) : 4096;
+    const size_t pool_counts[] = { 4, 8, 12, 16, 24, 32 };
+
+    printf("chunk size %zu, %zu colors of %zu bytes\n", chunk_size, POOL_CACHE_COLORS, POOL_CACHE_LINE_SIZE);
+    const size_t run_count = sizeof(pool_counts) / sizeof(pool_counts[0]);
+    std::vector<Pools *> uncolored;
+    std::vector<Pools *> colored;
+    for (size_t i = 0; i < run_count; i++)
+    {
+        uncolored.push_back(new Pools(pool_counts[i], chunk_size, false));
+        colored.push_back(new Pools(pool_counts[i], chunk_size, true));
+    }
+
+    printf("pools  uncolored (sets, ns/load)  colored (sets, ns/load)\n");
+    for (size_t i = 0; i < run_count; i++)
+    {
+        double uncolored_time = uncolored[i]->walk();
+        double colored_time = colored[i]->walk();
+        printf("%5zu  %9zu %12.2f  %11zu %11.2f\n", pool_counts[i], uncolored[i]->distinct_sets(), uncolored_time,
+               colored[i]->distinct_sets(), colored_time);
+    }
+
+    for (size_t i = 0; i < run_count; i++)
+    {
+        delete uncolored[i];
+        delete colored[i];
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+    Measures stream_copy() against memcpy() (stream_copy.h), to check STREAM_COPY_THRESHOLD.
+
+    The first table is plain copy bandwidth at sizes around the threshold. The destination is written once
+    beforehand, so page faults aren't counted, and each size is copied repeatedly, so the small sizes run
+    from cache, which is where streaming stores lose.
+
+    The second table is what a copy costs the rest of the program. A working set (by default 1 MiB) is
+    walked as a random chain of dependent loads until it's cached, then each copy is followed by one more
+    walk, and the slowdown of that walk over an undisturbed one is what the copy evicted. The walk runs
+    right after the copy rather than on another thread, which shows the same eviction without depending on
+    the machine's core count and cache sharing; the working set is the part of the last-level cache a
+    concurrently running workload would have lost.
+
+    Build: g++ -std=c++11 -O2 -I.. stream_copy.cpp -o stream_copy
+    Usage: stream_copy [working set in KiB]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "stream_copy.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void copy(bool streaming, unsigned char *destination, const unsigned char *source, size_t size)
+{
+    if (streaming)
+        stream_copy(destination, source, size);
+    else
+        memcpy(destination, source, size);
+}
+
+static double copy_bandwidth(bool streaming, unsigned char *destination, const unsigned char *source, size_t size)
+{
+    size_t repeat_count = std::max<size_t>((size_t(1) << 31) / size, 4); // About 2 GiB copied per size
+    copy(streaming, destination, source, size); // Warm up
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < repeat_count; i++)
+        copy(streaming, destination, source, size);
+    return size * repeat_count / seconds_since(start) / 1e9;
+}
+
+// One cache line per link, in random order so the prefetchers can't hide the misses
+struct Chain
+{
+    std::vector<void *> lines;
+    void *start;
+
+    Chain(size_t size)
+    {
+        size_t line_count = size / 64;
+        lines.resize(line_count * 8);
+        std::vector<size_t> order(line_count);
+        for (size_t i = 0; i < line_count; i++)
+            order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937_64(7));
+        for (size_t i = 0; i < line_count; i++)
+            lines[order[i] * 8] = &lines[order[(i + 1) % line_count] * 8];
+        start = &lines[order[0] * 8];
+    }
+
+    double walk() const
+    {
+        size_t line_count = lines.size() / 8;
+        void *line = start;
+        Clock::time_point begin = Clock::now();
+        for (size_t i = 0; i < line_count; i++)
+            line = *static_cast<void **>(line);
+        double elapsed = seconds_since(begin);
+        if (!line)
+            printf("unreachable\n"); // Keeps the walk from being optimized away
+        return elapsed * 1e9 / line_count;
+    }
+};
+
+static double walk_after_copies(const Chain &chain, bool streaming, unsigned char *destination,
+                                const unsigned char *source, size_t size)
+{
+    constexpr int ROUND_COUNT = 20;
+    double total = 0;
+    for (int i = 0; i < ROUND_COUNT; i++)
+    {
+        chain.walk();
+        chain.walk(); // Cached again
+        copy(streaming, destination, source, size);
+        total += chain.walk();
+    }
+    return total / ROUND_COUNT;
+}
+
+int main(int argc, char **argv)
+{
+    size_t working_set = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024) * 1024;
+    size_t max_size = 256 * 1024 * 1024;
+
+    unsigned char *source = static_cast<unsigned char *>(malloc(max_size));
+    unsigned char *destination = static_cast<unsigned char *>(malloc(max_size));
+    memset(source, 1, max_size);
+    memset(destination, 2, max_size);
+
+    printf("Threshold %zu KiB\n\n", STREAM_COPY_THRESHOLD / 1024);
+    printf("    size      memcpy  stream_copy (GB/s)\n");
+    for (size_t size = 256 * 1024; size <= max_size; size *= 2)
+    {
+        double memcpy_bandwidth = copy_bandwidth(false, destination, source, size);
+        double stream_bandwidth = copy_bandwidth(true, destination, source, size);
+        printf("%6zu KiB %9.2f %12.2f%s\n", size / 1024, memcpy_bandwidth, stream_bandwidth,
+               size == STREAM_COPY_THRESHOLD ? "  <- threshold" : "");
+    }
+
+    Chain chain(working_set);
+    chain.walk();
+    double undisturbed = 0;
+    for (int i = 0; i < 20; i++)
+        undisturbed += chain.walk();
+    undisturbed /= 20;
+
+    printf("\n%zu KiB working set walk: %.2f ns/load undisturbed\n", working_set / 1024, undisturbed);
+    printf("    size   after memcpy  after stream_copy (ns/load)\n");
+    for (size_t size = 1024 * 1024; size <= 64 * 1024 * 1024; size *= 4)
+    {
+        double after_memcpy = walk_after_copies(chain, false, destination, source, size);
+        double after_stream = walk_after_copies(chain, true, destination, source, size);
+        printf("%6zu KiB %14.2f %18.2f\n", size / 1024, after_memcpy, after_stream);
+    }
+
+    free(source);
+    free(destination);
+    return 0;
+}
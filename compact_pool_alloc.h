@@ -0,0 +1,145 @@
+/*
+    The compact pool allocator is a pool allocator for very small chunks.
+
+    Allocation and individual frees are performed in O(1) time using a free list stored
+    across unused chunks, exactly like the pool allocator.
+
+    The difference is what the free list stores. The pool allocator keeps a full pointer in each free chunk,
+    so a chunk can never be smaller than a pointer, and chunks are rounded up to alignof(max_align_t) by
+    default. For pools of millions of 4- or 8-byte objects, that's 2-4x the memory actually needed. Here,
+    the free list instead stores the index of the next free chunk, using whatever unsigned integer type the
+    pool is instantiated with (uint16_t or uint32_t, typically), so the smallest chunk is the size of that
+    index type. The index type also bounds the chunk count, since the largest index is reserved to mark the
+    end of the list.
+
+    Chunks are only aligned as requested. When no alignment is given, chunks get the natural alignment for
+    their size (the largest power of two dividing it, capped at alignof(max_align_t)), which is the most any
+    object of that size can require. Because of that, the index in a free chunk may be misaligned for the
+    index type, so it's accessed with memcpy, which compilers reduce to a plain load/store. Alignments
+    beyond alignof(max_align_t) are honored by over-allocating the buffer and aligning its start.
+*/
+
+#ifndef COMPACT_POOL_ALLOC_H
+#define COMPACT_POOL_ALLOC_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
+
+template <typename Index>
+class CompactPoolAllocator
+{
+    static_assert(std::is_unsigned<Index>::value, "The index type must be an unsigned integer");
+
+    private:
+        static const Index END_OF_LIST = static_cast<Index>(~static_cast<Index>(0));
+
+        size_t _chunk_count;
+        size_t _chunk_size;
+        unsigned char *_memory; // What was actually allocated; _buffer is aligned within it
+        unsigned char *_buffer;
+        Index _free_list_head;
+
+        void init(size_t chunk_count, size_t chunk_size, size_t chunk_alignment);
+        Index next_index(Index index);
+        void set_next_index(Index index, Index next);
+
+    public:
+        CompactPoolAllocator(size_t chunk_count, size_t chunk_size);
+        CompactPoolAllocator(size_t chunk_count, size_t chunk_size, size_t chunk_alignment);
+        ~CompactPoolAllocator();
+        void *alloc();
+        void free(void *chunk);
+        void free_all();
+};
+
+typedef CompactPoolAllocator<uint16_t> CompactPoolAllocator16;
+typedef CompactPoolAllocator<uint32_t> CompactPoolAllocator32;
+
+template <typename Index>
+CompactPoolAllocator<Index>::CompactPoolAllocator(size_t chunk_count, size_t chunk_size)
+{
+    size_t natural_alignment = chunk_size & (~chunk_size + 1); // Lowest set bit
+    if (natural_alignment == 0 || natural_alignment > alignof(max_align_t))
+        natural_alignment = alignof(max_align_t);
+    init(chunk_count, chunk_size, natural_alignment);
+}
+
+template <typename Index>
+CompactPoolAllocator<Index>::CompactPoolAllocator(size_t chunk_count, size_t chunk_size, size_t chunk_alignment)
+{
+    init(chunk_count, chunk_size, chunk_alignment);
+}
+
+template <typename Index>
+CompactPoolAllocator<Index>::~CompactPoolAllocator()
+{
+    std::free(_memory);
+}
+
+template <typename Index>
+void CompactPoolAllocator<Index>::init(size_t chunk_count, size_t chunk_size, size_t chunk_alignment)
+{
+    assert((chunk_alignment & (chunk_alignment - 1)) == 0); // Alignment must be a power of two
+    assert(chunk_count > 0 && chunk_count <= END_OF_LIST); // The largest index marks the end of the free list
+
+    if (chunk_size < sizeof(Index))
+        chunk_size = sizeof(Index);
+
+    _chunk_count = chunk_count;
+    _chunk_size = (chunk_size + chunk_alignment - 1) & ~(chunk_alignment - 1);
+
+    // malloc() already guarantees alignof(max_align_t), so only over-allocate for stricter alignments
+    size_t padding = chunk_alignment > alignof(max_align_t) ? chunk_alignment - 1 : 0;
+    _memory = static_cast<unsigned char *>(malloc(chunk_count * _chunk_size + padding));
+    _buffer = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(_memory) + padding) & ~(uintptr_t)(chunk_alignment - 1));
+    free_all(); // Build initial free list
+}
+
+template <typename Index>
+Index CompactPoolAllocator<Index>::next_index(Index index)
+{
+    Index next;
+    memcpy(&next, _buffer + index * _chunk_size, sizeof(Index));
+    return next;
+}
+
+template <typename Index>
+void CompactPoolAllocator<Index>::set_next_index(Index index, Index next)
+{
+    memcpy(_buffer + index * _chunk_size, &next, sizeof(Index));
+}
+
+template <typename Index>
+void *CompactPoolAllocator<Index>::alloc()
+{
+    Index free_index = _free_list_head;
+
+    if (free_index == END_OF_LIST)
+        return nullptr;
+
+    _free_list_head = next_index(free_index);
+    return _buffer + free_index * _chunk_size;
+}
+
+template <typename Index>
+void CompactPoolAllocator<Index>::free(void *chunk)
+{
+    Index free_index = static_cast<Index>((static_cast<unsigned char *>(chunk) - _buffer) / _chunk_size);
+    set_next_index(free_index, _free_list_head);
+    _free_list_head = free_index;
+}
+
+template <typename Index>
+void CompactPoolAllocator<Index>::free_all()
+{
+    _free_list_head = 0;
+    for (size_t i = 0; i < _chunk_count - 1; i++)
+        set_next_index(static_cast<Index>(i), static_cast<Index>(i + 1));
+    set_next_index(static_cast<Index>(_chunk_count - 1), END_OF_LIST);
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+    The concurrent arena allocator is an arena allocator that many threads can allocate from at once, for
+    parallel workers whose results share one lifetime.
+
+    Allocation is performed in amortized O(1) time, without locks.
+
+    Wrapping the arena allocator in a mutex serializes every allocation. Here, the current block's offset is
+    atomic, and an allocation reserves its range with a compare-and-swap on it (a fetch_add would be a single
+    instruction, but couldn't honor alignment without wasting alignment - 1 bytes on every call). Threads
+    only contend on that one cache line, and a failed CAS just retries with the offset it saw.
+
+    When the current block is exhausted, every thread that notices tries to install a new block with a CAS on
+    the current block pointer. The new block is prepared privately, with the thread's own allocation already
+    carved out of it, so the winner's allocation is done the moment the block is published. The losers free
+    their blocks and retry in the winner's. Blocks grow by 1.5x, or to the allocation size if larger, and
+    the remaining space in the old block is abandoned, as in the arena allocator.
+
+    Blocks are never released while the arena is in use, so a thread that loaded an old current block can
+    always still read it, and there is no reclamation problem to solve. The flip side is that reset() and
+    free() must not run concurrently with allocations (typically, they're called after the workers have been
+    joined). reset() keeps only the newest (and largest) block, and free() goes back to a block of the initial
+    capacity. The destructor releases everything.
+
+    As in the arena allocator, alloc_align() aligns offsets, so every block's buffer is allocated with the
+    strictest alignment that will be requested: max_alignment if given, or alignof(max_align_t) otherwise.
+    There's no packing, since tracking the total size would add a second contended atomic to every
+    allocation.
+*/
+
+#ifndef CONCURRENT_ARENA_ALLOC_H
+#define CONCURRENT_ARENA_ALLOC_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <new>
+#include <atomic>
+
+struct ConcurrentArenaBlock
+{
+    std::atomic<size_t> offset;
+    size_t capacity;
+    unsigned char *buffer;
+    ConcurrentArenaBlock *next; // The previous (older) block
+};
+
+class ConcurrentArenaAllocator
+{
+    private:
+        std::atomic<ConcurrentArenaBlock *> _current;
+        size_t _initial_capacity;
+        size_t _max_alignment;
+
+        ConcurrentArenaBlock *create_block(size_t capacity);
+        void release_blocks(ConcurrentArenaBlock *block);
+        void *grow(ConcurrentArenaBlock *block, size_t size);
+
+    public:
+        ConcurrentArenaAllocator(size_t capacity);
+        ConcurrentArenaAllocator(size_t capacity, size_t max_alignment);
+        ~ConcurrentArenaAllocator();
+        void *alloc(size_t size);
+        void *alloc_align(size_t size, size_t alignment);
+        void reset();
+        void free();
+};
+
+ConcurrentArenaAllocator::ConcurrentArenaAllocator(size_t capacity)
+    : ConcurrentArenaAllocator(capacity, alignof(max_align_t))
+{
+}
+
+ConcurrentArenaAllocator::ConcurrentArenaAllocator(size_t capacity, size_t max_alignment)
+{
+    assert((max_alignment & (max_alignment - 1)) == 0); // Alignment must be a power of two
+
+    _max_alignment = std::max(max_alignment, alignof(max_align_t));
+    _initial_capacity = capacity;
+    _current.store(create_block(capacity), std::memory_order_relaxed);
+}
+
+ConcurrentArenaAllocator::~ConcurrentArenaAllocator()
+{
+    release_blocks(_current.load(std::memory_order_relaxed));
+}
+
+ConcurrentArenaBlock *ConcurrentArenaAllocator::create_block(size_t capacity)
+{
+    // The buffer follows the header, which is only aligned to alignof(max_align_t)
+    size_t padding = _max_alignment > alignof(max_align_t) ? _max_alignment - 1 : 0;
+    void *memory = malloc(sizeof(ConcurrentArenaBlock) + padding + capacity);
+    if (!memory)
+        return nullptr;
+
+    ConcurrentArenaBlock *block = new (memory) ConcurrentArenaBlock;
+    block->offset.store(0, std::memory_order_relaxed);
+    block->capacity = capacity;
+    block->buffer = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(block + 1) + padding) & ~(uintptr_t)(_max_alignment - 1));
+    block->next = nullptr;
+    return block;
+}
+
+void ConcurrentArenaAllocator::release_blocks(ConcurrentArenaBlock *block)
+{
+    while (block)
+    {
+        ConcurrentArenaBlock *next = block->next;
+        block->~ConcurrentArenaBlock();
+        std::free(block);
+        block = next;
+    }
+}
+
+void *ConcurrentArenaAllocator::grow(ConcurrentArenaBlock *block, size_t size)
+{
+    ConcurrentArenaBlock *new_block = create_block(std::max(block->capacity + block->capacity / 2, size));
+    if (!new_block)
+        return nullptr; // Out of memory
+
+    // Carve this allocation out before publishing the block, so nobody can take it from us
+    new_block->offset.store(size, std::memory_order_relaxed);
+    new_block->next = block;
+
+    // Release, so threads that acquire the new block see its header initialized
+    ConcurrentArenaBlock *expected = block;
+    if (_current.compare_exchange_strong(expected, new_block, std::memory_order_release, std::memory_order_relaxed))
+        return new_block->buffer;
+
+    // Another thread installed a block first
+    new_block->~ConcurrentArenaBlock();
+    std::free(new_block);
+    return nullptr;
+}
+
+void *ConcurrentArenaAllocator::alloc(size_t size)
+{
+    return alloc_align(size, alignof(max_align_t));
+}
+
+void *ConcurrentArenaAllocator::alloc_align(size_t size, size_t alignment)
+{
+    assert((alignment & (alignment - 1)) == 0); // Alignment must be a power of two
+    assert(alignment <= _max_alignment); // Block buffers are only aligned to _max_alignment
+
+    for (;;)
+    {
+        ConcurrentArenaBlock *block = _current.load(std::memory_order_acquire);
+        size_t offset = block->offset.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t corrected_offset = (offset + alignment - 1) & ~(alignment - 1);
+            if (corrected_offset > block->capacity || size > block->capacity - corrected_offset)
+                break; // Exhausted
+
+            // Only space is being claimed, nothing is published through the offset, so relaxed is enough
+            if (block->offset.compare_exchange_weak(offset, corrected_offset + size, std::memory_order_relaxed))
+                return &block->buffer[corrected_offset];
+        }
+
+        void *memory = grow(block, size);
+        if (memory)
+            return memory;
+        if (_current.load(std::memory_order_relaxed) == block)
+            return nullptr; // Out of memory, not a lost race
+    }
+}
+
+void ConcurrentArenaAllocator::reset()
+{
+    ConcurrentArenaBlock *block = _current.load(std::memory_order_relaxed);
+    release_blocks(block->next);
+    block->next = nullptr;
+    block->offset.store(0, std::memory_order_relaxed);
+}
+
+void ConcurrentArenaAllocator::free()
+{
+    ConcurrentArenaBlock *block = _current.load(std::memory_order_relaxed);
+    if (block->capacity == _initial_capacity)
+    {
+        reset();
+        return;
+    }
+
+    ConcurrentArenaBlock *new_block = create_block(_initial_capacity);
+    if (!new_block)
+    {
+        reset(); // Keep the big block rather than have no block at all
+        return;
+    }
+    release_blocks(block);
+    _current.store(new_block, std::memory_order_relaxed);
+}
+
+#endif
@@ -7,42 +7,97 @@
 
     The linear allocator is often conflated with the arena allocator, but the latter is actually a higher-level system
     which grows dynamically.
+
+    alloc_align() aligns the offset, not the address, so it can only honor alignments that the buffer itself
+    has. By default that's alignof(max_align_t), which is what malloc() gives. For stricter alignments (e.g.
+    64 for AVX-512, or 4096 for O_DIRECT), pass the largest alignment that will ever be requested as
+    max_alignment, and the buffer is allocated with it.
+
+    grow_in_place() extends the most recent allocation into the free space right after it, which is what
+    lets a growable container (see arena_containers.h) that owns the last allocation grow without copying.
+    It returns false, changing nothing, for any other allocation or when there isn't enough space.
+
+    alloc_zeroed() is alloc() for memory that must start out zeroed, and it skips the memset() where the
+    memory is known to be zero already. The allocator tracks a dirty size: past it, everything that hasn't
+    been handed out since is still zero. free() raises it to the old offset, and alloc_zeroed() only clears
+    the part of an allocation below it. The buffer comes from malloc(), so it starts out dirty throughout,
+    but on Linux, release_pages() hands the dirty pages past the offset back to the OS with MADV_DONTNEED,
+    which both shrinks the footprint of an idle allocator and makes those pages (zero-filled on the next
+    touch) clean again. Elsewhere, release_pages() does nothing.
 */
 
 #ifndef LINEAR_ALLOC_H
 #define LINEAR_ALLOC_H
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstddef>
 #include <cstring>
+#include <cstdint>
 #include <cassert>
 
+#include "stream_copy.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 class LinearAllocator
 {
     private:
         size_t _offset;
         size_t _capacity;
+        size_t _max_alignment;
+        size_t _dirty_size; // The buffer is zero past this, except for what has been handed out since
+        unsigned char *_memory; // What was actually allocated; _buffer is aligned within it
         unsigned char *_buffer;
 
+        void allocate_buffer(size_t capacity);
+
     public:
         LinearAllocator(size_t capacity);
+        LinearAllocator(size_t capacity, size_t max_alignment);
         ~LinearAllocator();
         void *alloc(size_t size);
         void *alloc_align(size_t size, size_t alignment);
+        void *alloc_zeroed(size_t size);
+        bool grow_in_place(void *memory, size_t old_size, size_t new_size);
         void resize(size_t capacity);
         void free();
+        void release_pages();
 };
 
 LinearAllocator::LinearAllocator(size_t capacity)
 {
     _offset = 0;
     _capacity = capacity;
-    _buffer = static_cast<unsigned char*>(malloc(capacity));
+    _max_alignment = alignof(max_align_t);
+    allocate_buffer(capacity);
+}
+
+LinearAllocator::LinearAllocator(size_t capacity, size_t max_alignment)
+{
+    assert((max_alignment & (max_alignment - 1)) == 0); // Alignment must be a power of two
+
+    _offset = 0;
+    _capacity = capacity;
+    _max_alignment = std::max(max_alignment, alignof(max_align_t));
+    allocate_buffer(capacity);
 }
 
 LinearAllocator::~LinearAllocator()
 {
-    std::free(_buffer);
+    std::free(_memory);
+}
+
+void LinearAllocator::allocate_buffer(size_t capacity)
+{
+    // malloc() already guarantees alignof(max_align_t), so only over-allocate for stricter alignments
+    size_t padding = _max_alignment > alignof(max_align_t) ? _max_alignment - 1 : 0;
+    _memory = static_cast<unsigned char *>(malloc(capacity + padding));
+    _dirty_size = capacity; // Nothing is known about what malloc() returns
+    _buffer = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(_memory) + padding) & ~(uintptr_t)(_max_alignment - 1));
 }
 
 void *LinearAllocator::alloc(size_t size)
@@ -61,6 +116,7 @@ void *LinearAllocator::alloc(size_t size)
 void *LinearAllocator::alloc_align(size_t size, size_t alignment)
 {
     assert((alignment & (alignment - 1)) == 0); // Alignment must be a power of two
+    assert(alignment <= _max_alignment); // The buffer itself is only aligned to _max_alignment
     
     size_t corrected_offset = (_offset + alignment - 1) & ~(alignment - 1);
     if (size <= _capacity - corrected_offset)
@@ -71,21 +127,70 @@ void *LinearAllocator::alloc_align(size_t size, size_t alignment)
     return nullptr; // Out of space
 }
 
+void *LinearAllocator::alloc_zeroed(size_t size)
+{
+    unsigned char *memory = static_cast<unsigned char *>(alloc(size));
+    if (!memory)
+        return nullptr;
+
+    // Only what was handed out before the last free can be dirty
+    size_t start = memory - _buffer;
+    if (start < _dirty_size)
+        memset(memory, 0, std::min(size, _dirty_size - start));
+    return memory;
+}
+
+bool LinearAllocator::grow_in_place(void *memory, size_t old_size, size_t new_size)
+{
+    // Only the last allocation ends at the offset
+    if (new_size < old_size || static_cast<unsigned char *>(memory) + old_size != _buffer + _offset)
+        return false;
+    if (new_size - old_size > _capacity - _offset)
+        return false; // Out of space
+
+    _offset += new_size - old_size;
+    return true;
+}
+
 void LinearAllocator::resize(size_t capacity)
 {
     if (capacity <= _capacity)
         return;
 
-    unsigned char *new_buffer = static_cast<unsigned char *>(malloc(capacity));
-    memcpy(new_buffer, _buffer, _offset);
-    std::free(_buffer);
-    _buffer = new_buffer;
+    unsigned char *old_memory = _memory;
+    unsigned char *old_buffer = _buffer;
+    allocate_buffer(capacity);
+    if (_offset >= STREAM_COPY_THRESHOLD)
+        stream_copy(_buffer, old_buffer, _offset); // Don't read the new buffer's lines into the cache just to overwrite them
+    else
+        memcpy(_buffer, old_buffer, _offset);
+    std::free(old_memory);
     _capacity = capacity;
 }
 
 void LinearAllocator::free()
 {
+    _dirty_size = std::max(_dirty_size, _offset);
     _offset = 0;
 }
 
+void LinearAllocator::release_pages()
+{
+#if defined(__linux__)
+    // Other systems don't promise that MADV_DONTNEED pages come back zeroed
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (_dirty_size <= _offset)
+        return;
+
+    uintptr_t start = (reinterpret_cast<uintptr_t>(_buffer + _offset) + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(_buffer + _dirty_size) & ~(uintptr_t)(page_size - 1);
+    if (start >= end || madvise(reinterpret_cast<void *>(start), end - start, MADV_DONTNEED) != 0)
+        return;
+
+    // Clear the partial page after the released ones, so everything from start on is clean
+    memset(reinterpret_cast<unsigned char *>(end), 0, (_buffer + _dirty_size) - reinterpret_cast<unsigned char *>(end));
+    _dirty_size = reinterpret_cast<unsigned char *>(start) - _buffer;
+#endif
+}
+
 #endif
@@ -3,6 +3,25 @@
 
     Allocation and individual frees are performed in O(1) time using a free list stored
     across unused chunks.
+
+    Since frees push onto the front of the free list, a long run of random frees leaves the list in random
+    address order, so consecutive allocations end up scattered across cache lines and pages. sort_free_list()
+    rebuilds the list in address order, which (the buffer being contiguous) also groups it by page. Rather
+    than sorting the list, it walks it once to mark the free chunks in a bitmap (one bit per chunk, allocated
+    for the call), then sweeps the bitmap in address order and relinks the marked chunks, so it's O(n) in the
+    number of chunks and only chases the list's pointers once. It still touches every free chunk, though, so
+    it is meant to be called explicitly at convenient points (e.g. after a load spike), not on every free.
+
+    When several pools with identical chunk sizes are used together, their buffers tend to start at the same
+    offset within a page, so their hot chunks map to the same cache sets and evict each other even though
+    the cache has plenty of room. To avoid this, each pool "colors" its buffer: the first chunk is offset by
+    a multiple of the cache line size, taken from a counter that rotates across all pools in the process.
+    This costs at most (POOL_CACHE_COLORS - 1) cache lines per pool. Pools with chunk alignment larger than
+    a cache line aren't colored, since the offset would break the alignment.
+
+    Chunk alignments beyond alignof(max_align_t) (e.g. 64 for AVX-512, or 4096 for O_DIRECT) are honored by
+    over-allocating the buffer and aligning its start, since rounding the chunk size alone does nothing for
+    where chunk 0 lands.
 */
 
 #ifndef POOL_ALLOC_H
@@ -10,7 +29,12 @@
 
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
 #include <cassert>
+#include <atomic>
+
+constexpr size_t POOL_CACHE_LINE_SIZE = 64;
+constexpr size_t POOL_CACHE_COLORS = 8;
 
 struct FreePoolNode
 {
@@ -22,9 +46,12 @@ class PoolAllocator
     private:
         size_t _chunk_count;
         size_t _chunk_size;
+        unsigned char *_memory; // What was actually allocated; _buffer is offset into it by the color
         unsigned char *_buffer;
         FreePoolNode *_free_list_head;
 
+        void allocate_buffer(size_t chunk_alignment);
+
     public:
         PoolAllocator(size_t chunk_count, size_t chunk_size);
         PoolAllocator(size_t chunk_count, size_t chunk_size, size_t chunk_alignment);
@@ -32,6 +59,7 @@ class PoolAllocator
         void *alloc();
         void free(void *chunk);
         void free_all();
+        void sort_free_list();
 };
 
 PoolAllocator::PoolAllocator(size_t chunk_count, size_t chunk_size)
@@ -40,7 +68,7 @@ PoolAllocator::PoolAllocator(size_t chunk_count, size_t chunk_size)
 
     _chunk_count = chunk_count;
     _chunk_size = (chunk_size + DEFAULT_ALIGNMENT - 1) & ~(DEFAULT_ALIGNMENT - 1);
-    _buffer = static_cast<unsigned char *>(malloc(chunk_count * _chunk_size));
+    allocate_buffer(DEFAULT_ALIGNMENT);
     free_all(); // Build initial free list
 }
 
@@ -50,13 +78,28 @@ PoolAllocator::PoolAllocator(size_t chunk_count, size_t chunk_size, size_t chunk
 
     _chunk_count = chunk_count;
     _chunk_size = (chunk_size + chunk_alignment - 1) & ~(chunk_alignment - 1);
-    _buffer = static_cast<unsigned char *>(malloc(chunk_count * _chunk_size));
+    allocate_buffer(chunk_alignment);
     free_all(); // Build initial free list
 }
 
 PoolAllocator::~PoolAllocator()
 {
-    std::free(_buffer);
+    std::free(_memory);
+}
+
+void PoolAllocator::allocate_buffer(size_t chunk_alignment)
+{
+    static std::atomic<size_t> next_color(0);
+
+    size_t color_offset = 0;
+    if (chunk_alignment <= POOL_CACHE_LINE_SIZE)
+        color_offset = (next_color.fetch_add(1, std::memory_order_relaxed) % POOL_CACHE_COLORS) * POOL_CACHE_LINE_SIZE;
+
+    // malloc() already guarantees alignof(max_align_t), so only over-allocate for stricter alignments
+    size_t padding = chunk_alignment > alignof(max_align_t) ? chunk_alignment - 1 : 0;
+    _memory = static_cast<unsigned char *>(malloc(_chunk_count * _chunk_size + color_offset + padding));
+    _buffer = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(_memory) + padding) & ~(uintptr_t)(chunk_alignment - 1));
+    _buffer += color_offset;
 }
 
 void *PoolAllocator::alloc()
@@ -89,4 +132,39 @@ void PoolAllocator::free_all()
     current_free_node->next = nullptr;
 }
 
+void PoolAllocator::sort_free_list()
+{
+    if (!_free_list_head)
+        return;
+
+    size_t word_bits = sizeof(uint64_t) * 8;
+    size_t word_count = (_chunk_count + word_bits - 1) / word_bits;
+    uint64_t *free_chunks = static_cast<uint64_t *>(calloc(word_count, sizeof(uint64_t)));
+    if (!free_chunks)
+        return; // Out of memory, so keep the list as it is
+
+    for (FreePoolNode *node = _free_list_head; node; node = node->next)
+    {
+        size_t index = (reinterpret_cast<unsigned char *>(node) - _buffer) / _chunk_size;
+        free_chunks[index / word_bits] |= uint64_t(1) << (index % word_bits);
+    }
+
+    FreePoolNode **tail = &_free_list_head;
+    for (size_t word = 0; word < word_count; word++)
+    {
+        size_t bit = 0;
+        for (uint64_t bits = free_chunks[word]; bits; bits >>= 1, bit++)
+        {
+            if (!(bits & 1))
+                continue;
+            FreePoolNode *node = reinterpret_cast<FreePoolNode *>(_buffer + (word * word_bits + bit) * _chunk_size);
+            *tail = node;
+            tail = &node->next;
+        }
+    }
+    *tail = nullptr;
+
+    std::free(free_chunks);
+}
+
 #endif
@@ -0,0 +1,373 @@
+/*
+    The slab pool allocator is a pool allocator that grows dynamically by mapping additional slabs, and that
+    gives completely empty slabs back to the OS. It relates to the pool allocator the same way the arena
+    allocator relates to the linear allocator.
+
+    Allocation and individual frees are performed in O(1) time.
+
+    Each slab is a block of slab_size bytes (a power of two) mapped directly from the OS and aligned to its own
+    size, which lets free() find a chunk's slab by masking the address instead of searching. The slab starts
+    with a small header holding its own free list and an occupancy counter. Keeping the free lists per slab,
+    rather than one global list as in the pool allocator, is what makes releasing a slab O(1): once its
+    counter drops to zero, none of its chunks are reachable from anywhere else, so it can simply be unlinked
+    and unmapped.
+
+    Slabs with free chunks are kept on an "available" list, with empty slabs at the tail, so allocations are
+    served from partially used slabs first and empty slabs get a chance to stay empty. Releasing a slab the
+    moment it becomes empty would thrash under a load that oscillates around a slab boundary, so up to
+    max_empty_slabs empty slabs are retained; only beyond that are they unmapped. release_empty_slabs()
+    unmaps all of them explicitly.
+
+    Chunks in a fresh slab are carved lazily (with a bump index) instead of threading a free list through
+    the whole slab up front, so pages that are never used are never touched and never count toward RSS.
+
+    This also means that a chunk carved for the first time from a fresh slab is still zero, as mapped by
+    the OS. alloc_zeroed() takes advantage of it: each slab tracks how far carving has ever gone (carving
+    starts over when an empty slab is reused), and only chunks from the free list or below that point are
+    cleared with memset().
+
+    Since every slab starts on a slab_size boundary, the same chunk in every slab (and in every pool with the
+    same geometry) would map to the same cache sets. Slabs are therefore colored: whatever space is left over
+    after fitting the chunks is used to offset the first chunk by a multiple of the cache line, rotating from
+    one slab to the next. The starting color is itself taken from a process-wide counter, so pools created
+    side by side don't all begin with the same color.
+*/
+
+#ifndef SLAB_POOL_ALLOC_H
+#define SLAB_POOL_ALLOC_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <atomic>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // Or windows.h defines min()/max() macros that break std::min()/std::max()
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+constexpr size_t SLAB_CACHE_LINE_SIZE = 64;
+
+struct FreeSlabNode
+{
+    FreeSlabNode *next;
+};
+
+struct PoolSlab
+{
+    PoolSlab *prev;
+    PoolSlab *next;
+    FreeSlabNode *free_list;
+    size_t used_count;
+    size_t carved_count; // Chunks past this index haven't been handed out since the slab was last emptied
+    size_t dirty_count; // Chunks past this index have never been handed out at all, so they're still zero
+    unsigned char *chunks;
+};
+
+class SlabPoolAllocator
+{
+    private:
+        size_t _chunk_size;
+        size_t _chunk_offset; // Offset of the first chunk from the start of a slab
+        size_t _slab_size;
+        size_t _chunks_per_slab;
+        size_t _color_step;
+        size_t _color_count;
+        size_t _next_color;
+        size_t _max_empty_slabs;
+        size_t _slab_count;
+        size_t _empty_slab_count;
+        PoolSlab *_available_head; // Slabs with at least one free chunk, empty ones at the tail
+        PoolSlab *_available_tail;
+        PoolSlab *_full_head;
+
+        void init(size_t chunk_size, size_t chunk_alignment, size_t slab_size, size_t max_empty_slabs);
+        PoolSlab *map_slab();
+        void unmap_slab(PoolSlab *slab);
+        void unlink_available(PoolSlab *slab);
+        void unlink_full(PoolSlab *slab);
+        void push_available_front(PoolSlab *slab);
+        void push_available_back(PoolSlab *slab);
+        void *alloc_chunk(bool *zeroed);
+
+    public:
+        SlabPoolAllocator(size_t chunk_size, size_t slab_size, size_t max_empty_slabs);
+        SlabPoolAllocator(size_t chunk_size, size_t chunk_alignment, size_t slab_size, size_t max_empty_slabs);
+        ~SlabPoolAllocator();
+        void *alloc();
+        void *alloc_zeroed();
+        void free(void *chunk);
+        void release_empty_slabs();
+        size_t slab_count();
+};
+
+SlabPoolAllocator::SlabPoolAllocator(size_t chunk_size, size_t slab_size, size_t max_empty_slabs)
+{
+    init(chunk_size, alignof(max_align_t), slab_size, max_empty_slabs);
+}
+
+SlabPoolAllocator::SlabPoolAllocator(size_t chunk_size, size_t chunk_alignment, size_t slab_size, size_t max_empty_slabs)
+{
+    init(chunk_size, chunk_alignment, slab_size, max_empty_slabs);
+}
+
+SlabPoolAllocator::~SlabPoolAllocator()
+{
+    while (_available_head)
+    {
+        PoolSlab *slab = _available_head;
+        _available_head = slab->next;
+        unmap_slab(slab);
+    }
+    while (_full_head)
+    {
+        PoolSlab *slab = _full_head;
+        _full_head = slab->next;
+        unmap_slab(slab);
+    }
+}
+
+void SlabPoolAllocator::init(size_t chunk_size, size_t chunk_alignment, size_t slab_size, size_t max_empty_slabs)
+{
+    assert((chunk_alignment & (chunk_alignment - 1)) == 0); // Alignment must be a power of two
+    assert((slab_size & (slab_size - 1)) == 0); // Slab size must be a power of two (for the address mask)
+
+    if (chunk_size < sizeof(FreeSlabNode))
+        chunk_size = sizeof(FreeSlabNode);
+    if (chunk_alignment < alignof(FreeSlabNode))
+        chunk_alignment = alignof(FreeSlabNode);
+
+    _chunk_size = (chunk_size + chunk_alignment - 1) & ~(chunk_alignment - 1);
+    _chunk_offset = (sizeof(PoolSlab) + chunk_alignment - 1) & ~(chunk_alignment - 1);
+    _slab_size = slab_size;
+    assert(_chunk_offset + _chunk_size <= _slab_size); // A slab must hold at least one chunk
+    _chunks_per_slab = (_slab_size - _chunk_offset) / _chunk_size;
+
+    static std::atomic<size_t> next_starting_color(0);
+    _color_step = chunk_alignment > SLAB_CACHE_LINE_SIZE ? chunk_alignment : SLAB_CACHE_LINE_SIZE;
+    _color_count = (_slab_size - _chunk_offset - _chunks_per_slab * _chunk_size) / _color_step + 1;
+    _next_color = next_starting_color.fetch_add(1, std::memory_order_relaxed) % _color_count;
+
+    _max_empty_slabs = max_empty_slabs;
+    _slab_count = 0;
+    _empty_slab_count = 0;
+    _available_head = _available_tail = nullptr;
+    _full_head = nullptr;
+}
+
+PoolSlab *SlabPoolAllocator::map_slab()
+{
+    // Over-reserve so a slab_size-aligned range is guaranteed to fit, then give back the excess
+    unsigned char *slab_start;
+
+#if defined(_WIN32)
+    // VirtualFree() can't release part of a reservation, so find an aligned address and re-reserve exactly it
+    slab_start = nullptr;
+    while (!slab_start)
+    {
+        void *probe = VirtualAlloc(nullptr, _slab_size * 2, MEM_RESERVE, PAGE_NOACCESS);
+        if (!probe)
+            return nullptr;
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(probe) + _slab_size - 1) & ~(uintptr_t)(_slab_size - 1);
+        VirtualFree(probe, 0, MEM_RELEASE);
+        slab_start = static_cast<unsigned char *>(VirtualAlloc(reinterpret_cast<void *>(aligned), _slab_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    }
+#else
+    void *mapping = mmap(nullptr, _slab_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    unsigned char *mapping_start = static_cast<unsigned char *>(mapping);
+    slab_start = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(mapping_start) + _slab_size - 1) & ~(uintptr_t)(_slab_size - 1));
+    size_t head_excess = slab_start - mapping_start;
+    size_t tail_excess = _slab_size - head_excess;
+    if (head_excess)
+        munmap(mapping_start, head_excess);
+    if (tail_excess)
+        munmap(slab_start + _slab_size, tail_excess);
+#endif
+
+    PoolSlab *slab = reinterpret_cast<PoolSlab *>(slab_start);
+    slab->prev = slab->next = nullptr;
+    slab->free_list = nullptr;
+    slab->used_count = 0;
+    slab->carved_count = 0;
+    slab->dirty_count = 0; // Fresh pages
+    slab->chunks = slab_start + _chunk_offset + _next_color * _color_step;
+    _next_color = (_next_color + 1) % _color_count;
+    _slab_count++;
+    _empty_slab_count++;
+    return slab;
+}
+
+void SlabPoolAllocator::unmap_slab(PoolSlab *slab)
+{
+#if defined(_WIN32)
+    VirtualFree(slab, 0, MEM_RELEASE);
+#else
+    munmap(slab, _slab_size);
+#endif
+    _slab_count--;
+}
+
+void SlabPoolAllocator::unlink_available(PoolSlab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        _available_head = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    else
+        _available_tail = slab->prev;
+    slab->prev = slab->next = nullptr;
+}
+
+void SlabPoolAllocator::unlink_full(PoolSlab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        _full_head = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->prev = slab->next = nullptr;
+}
+
+void SlabPoolAllocator::push_available_front(PoolSlab *slab)
+{
+    slab->prev = nullptr;
+    slab->next = _available_head;
+    if (_available_head)
+        _available_head->prev = slab;
+    else
+        _available_tail = slab;
+    _available_head = slab;
+}
+
+void SlabPoolAllocator::push_available_back(PoolSlab *slab)
+{
+    slab->next = nullptr;
+    slab->prev = _available_tail;
+    if (_available_tail)
+        _available_tail->next = slab;
+    else
+        _available_head = slab;
+    _available_tail = slab;
+}
+
+void *SlabPoolAllocator::alloc()
+{
+    bool zeroed;
+    return alloc_chunk(&zeroed);
+}
+
+void *SlabPoolAllocator::alloc_zeroed()
+{
+    bool zeroed;
+    void *chunk = alloc_chunk(&zeroed);
+    if (chunk && !zeroed)
+        memset(chunk, 0, _chunk_size);
+    return chunk;
+}
+
+void *SlabPoolAllocator::alloc_chunk(bool *zeroed)
+{
+    PoolSlab *slab = _available_head;
+    if (!slab)
+    {
+        slab = map_slab();
+        if (!slab)
+            return nullptr; // Out of memory
+        push_available_front(slab);
+    }
+
+    void *chunk;
+    if (slab->free_list)
+    {
+        chunk = slab->free_list;
+        slab->free_list = slab->free_list->next;
+        *zeroed = false;
+    }
+    else
+    {
+        chunk = slab->chunks + slab->carved_count * _chunk_size;
+        *zeroed = slab->carved_count >= slab->dirty_count;
+        slab->carved_count++;
+    }
+
+    if (slab->used_count++ == 0)
+        _empty_slab_count--;
+
+    if (slab->used_count == _chunks_per_slab)
+    {
+        unlink_available(slab);
+        slab->next = _full_head;
+        if (_full_head)
+            _full_head->prev = slab;
+        _full_head = slab;
+    }
+
+    return chunk;
+}
+
+void SlabPoolAllocator::free(void *chunk)
+{
+    PoolSlab *slab = reinterpret_cast<PoolSlab *>(reinterpret_cast<uintptr_t>(chunk) & ~(uintptr_t)(_slab_size - 1));
+
+    FreeSlabNode *free_node = reinterpret_cast<FreeSlabNode *>(chunk);
+    free_node->next = slab->free_list;
+    slab->free_list = free_node;
+
+    if (slab->used_count == _chunks_per_slab)
+    {
+        unlink_full(slab);
+        push_available_front(slab);
+    }
+
+    if (--slab->used_count == 0)
+    {
+        unlink_available(slab);
+        if (_empty_slab_count >= _max_empty_slabs)
+        {
+            unmap_slab(slab);
+            return;
+        }
+
+        // Start carving from the beginning again so reuse of this slab is in address order
+        if (slab->carved_count > slab->dirty_count)
+            slab->dirty_count = slab->carved_count;
+        slab->free_list = nullptr;
+        slab->carved_count = 0;
+        push_available_back(slab);
+        _empty_slab_count++;
+    }
+}
+
+void SlabPoolAllocator::release_empty_slabs()
+{
+    // Empty slabs are always at the tail of the available list
+    while (_available_tail && _available_tail->used_count == 0)
+    {
+        PoolSlab *slab = _available_tail;
+        unlink_available(slab);
+        unmap_slab(slab);
+        _empty_slab_count--;
+    }
+}
+
+size_t SlabPoolAllocator::slab_count()
+{
+    return _slab_count;
+}
+
+#endif
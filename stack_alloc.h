@@ -5,44 +5,89 @@
     allocation, as some implementations do.
 
     Allocation is performed in amortized O(1) time.
+
+    As with the linear allocator, alignment is applied to offsets, so the buffer must be allocated with the
+    strictest alignment that alloc_align() will be asked for. That is max_alignment when given, or
+    alignof(max_align_t) otherwise.
+
+    As in the linear allocator, alloc_zeroed() skips the memset() for memory known to be zero: past the dirty
+    size, which free_to_offset() and free_all() raise to the old offset, nothing has been written since the
+    buffer was allocated or since release_pages() (Linux only) gave those pages back to the OS.
 */
 
 #ifndef STACK_ALLOC_H
 #define STACK_ALLOC_H
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstddef>
 #include <cstring>
+#include <cstdint>
 #include <cassert>
 
+#include "stream_copy.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 class StackAllocator
 {
     private:
         size_t _offset;
         size_t _capacity;
+        size_t _max_alignment;
+        size_t _dirty_size; // The buffer is zero past this, except for what has been handed out since
+        unsigned char *_memory; // What was actually allocated; _buffer is aligned within it
         unsigned char *_buffer;
 
+        void allocate_buffer(size_t capacity);
+
     public:
         StackAllocator(size_t capacity);
+        StackAllocator(size_t capacity, size_t max_alignment);
         ~StackAllocator();
         void *alloc(size_t size);
         void *alloc_align(size_t size, size_t alignment);
+        void *alloc_zeroed(size_t size);
         size_t get_offset();
         void free_to_offset(size_t offset);
         void resize(size_t capacity);
         void free_all();
+        void release_pages();
 };
 
 StackAllocator::StackAllocator(size_t capacity)
 {
     _offset = 0;
     _capacity = capacity;
-    _buffer = static_cast<unsigned char*>(malloc(capacity));
+    _max_alignment = alignof(max_align_t);
+    allocate_buffer(capacity);
+}
+
+StackAllocator::StackAllocator(size_t capacity, size_t max_alignment)
+{
+    assert((max_alignment & (max_alignment - 1)) == 0); // Alignment must be a power of two
+
+    _offset = 0;
+    _capacity = capacity;
+    _max_alignment = std::max(max_alignment, alignof(max_align_t));
+    allocate_buffer(capacity);
 }
 
 StackAllocator::~StackAllocator()
 {
-    std::free(_buffer);
+    std::free(_memory);
+}
+
+void StackAllocator::allocate_buffer(size_t capacity)
+{
+    // malloc() already guarantees alignof(max_align_t), so only over-allocate for stricter alignments
+    size_t padding = _max_alignment > alignof(max_align_t) ? _max_alignment - 1 : 0;
+    _memory = static_cast<unsigned char *>(malloc(capacity + padding));
+    _dirty_size = capacity; // Nothing is known about what malloc() returns
+    _buffer = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(_memory) + padding) & ~(uintptr_t)(_max_alignment - 1));
 }
 
 void *StackAllocator::alloc(size_t size)
@@ -61,6 +106,7 @@ void *StackAllocator::alloc(size_t size)
 void *StackAllocator::alloc_align(size_t size, size_t alignment)
 {
     assert((alignment & (alignment - 1)) == 0); // Alignment must be a power of two
+    assert(alignment <= _max_alignment); // The buffer itself is only aligned to _max_alignment
 
     size_t corrected_offset = (_offset + alignment - 1) & ~(alignment - 1);
     if (size <= _capacity - corrected_offset)
@@ -71,6 +117,19 @@ void *StackAllocator::alloc_align(size_t size, size_t alignment)
     return nullptr; // Out of space
 }
 
+void *StackAllocator::alloc_zeroed(size_t size)
+{
+    unsigned char *memory = static_cast<unsigned char *>(alloc(size));
+    if (!memory)
+        return nullptr;
+
+    // Only what was handed out before the last free can be dirty
+    size_t start = memory - _buffer;
+    if (start < _dirty_size)
+        memset(memory, 0, std::min(size, _dirty_size - start));
+    return memory;
+}
+
 size_t StackAllocator::get_offset()
 {
     return _offset;
@@ -79,6 +138,7 @@ size_t StackAllocator::get_offset()
 void StackAllocator::free_to_offset(size_t offset)
 {
     assert(offset >= 0 && offset < _offset);
+    _dirty_size = std::max(_dirty_size, _offset);
     _offset = offset;
 }
 
@@ -87,16 +147,40 @@ void StackAllocator::resize(size_t capacity)
     if (capacity <= _capacity)
         return;
 
-    unsigned char *new_buffer = static_cast<unsigned char *>(malloc(capacity));
-    memcpy(new_buffer, _buffer, _offset);
-    std::free(_buffer);
-    _buffer = new_buffer;
+    unsigned char *old_memory = _memory;
+    unsigned char *old_buffer = _buffer;
+    allocate_buffer(capacity);
+    if (_offset >= STREAM_COPY_THRESHOLD)
+        stream_copy(_buffer, old_buffer, _offset); // Don't read the new buffer's lines into the cache just to overwrite them
+    else
+        memcpy(_buffer, old_buffer, _offset);
+    std::free(old_memory);
     _capacity = capacity;
 }
 
 void StackAllocator::free_all()
 {
+    _dirty_size = std::max(_dirty_size, _offset);
     _offset = 0;
 }
 
+void StackAllocator::release_pages()
+{
+#if defined(__linux__)
+    // Other systems don't promise that MADV_DONTNEED pages come back zeroed
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (_dirty_size <= _offset)
+        return;
+
+    uintptr_t start = (reinterpret_cast<uintptr_t>(_buffer + _offset) + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(_buffer + _dirty_size) & ~(uintptr_t)(page_size - 1);
+    if (start >= end || madvise(reinterpret_cast<void *>(start), end - start, MADV_DONTNEED) != 0)
+        return;
+
+    // Clear the partial page after the released ones, so everything from start on is clean
+    memset(reinterpret_cast<unsigned char *>(end), 0, (_buffer + _dirty_size) - reinterpret_cast<unsigned char *>(end));
+    _dirty_size = reinterpret_cast<unsigned char *>(start) - _buffer;
+#endif
+}
+
 #endif
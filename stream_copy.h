@@ -0,0 +1,177 @@
+/*
+    stream_copy() is a memcpy() for copies far larger than the last-level cache, shared by the allocators
+    that move whole buffers around (ArenaAllocator's packing, and LinearAllocator/StackAllocator's resize()).
+
+    A plain memcpy() of a multi-gigabyte buffer streams all of it through the cache, evicting everything the
+    rest of the program was working with, even though the copy itself will never read any of it again.
+    Non-temporal (streaming) stores write the destination straight to memory instead, and since they don't
+    read the destination lines first, they save bandwidth. The source is still read through the cache, so a
+    copy larger than the cache evicts about as much either way; what stream_copy() saves is the bandwidth
+    and the destination's half of the cache traffic. It's slower than memcpy() for copies that fit in the
+    cache, though, so callers only use stream_copy() for copies of at least STREAM_COPY_THRESHOLD bytes (see
+    bench/stream_copy.cpp).
+
+    The widest kernel the CPU supports (AVX-512, AVX2 or SSE2) is picked at runtime on the first call, so the
+    same binary runs everywhere. On other architectures, stream_copy() is just memcpy().
+*/
+
+#ifndef STREAM_COPY_H
+#define STREAM_COPY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STREAM_COPY_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(STREAM_COPY_X86) && (defined(__GNUC__) || defined(__clang__))
+#define STREAM_COPY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define STREAM_COPY_TARGET(isa) // MSVC allows any intrinsic in any function
+#endif
+
+constexpr size_t STREAM_COPY_THRESHOLD = 4 * 1024 * 1024;
+
+typedef void (*StreamCopyKernel)(unsigned char *destination, const unsigned char *source, size_t size);
+
+#if defined(STREAM_COPY_X86)
+
+void stream_copy_memcpy(unsigned char *destination, const unsigned char *source, size_t size)
+{
+    memcpy(destination, source, size);
+}
+
+STREAM_COPY_TARGET("sse2")
+void stream_copy_sse2(unsigned char *destination, const unsigned char *source, size_t size)
+{
+    // Streaming stores must be aligned, so copy up to the first aligned destination normally
+    size_t head = (0 - reinterpret_cast<uintptr_t>(destination)) & 15;
+    if (head > size)
+        head = size;
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, destination += 64, source += 64)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination + 48), d);
+    }
+    _mm_sfence(); // Streaming stores are weakly ordered
+
+    memcpy(destination, source, size);
+}
+
+STREAM_COPY_TARGET("avx2")
+void stream_copy_avx2(unsigned char *destination, const unsigned char *source, size_t size)
+{
+    size_t head = (0 - reinterpret_cast<uintptr_t>(destination)) & 31;
+    if (head > size)
+        head = size;
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    for (; size >= 128; size -= 128, destination += 128, source += 128)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 96));
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(destination), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(destination + 32), b);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(destination + 64), c);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(destination + 96), d);
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+
+    memcpy(destination, source, size);
+}
+
+STREAM_COPY_TARGET("avx512f")
+void stream_copy_avx512(unsigned char *destination, const unsigned char *source, size_t size)
+{
+    size_t head = (0 - reinterpret_cast<uintptr_t>(destination)) & 63;
+    if (head > size)
+        head = size;
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    for (; size >= 256; size -= 256, destination += 256, source += 256)
+    {
+        __m512i a = _mm512_loadu_si512(source);
+        __m512i b = _mm512_loadu_si512(source + 64);
+        __m512i c = _mm512_loadu_si512(source + 128);
+        __m512i d = _mm512_loadu_si512(source + 192);
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(destination), a);
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(destination + 64), b);
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(destination + 128), c);
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(destination + 192), d);
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+
+    memcpy(destination, source, size);
+}
+
+StreamCopyKernel stream_copy_select_kernel()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool os_saves_avx = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6; // OSXSAVE, and XMM/YMM state enabled
+    bool os_saves_avx512 = os_saves_avx && (_xgetbv(0) & 0xe6) == 0xe6; // Plus opmask/ZMM state
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        if (os_saves_avx512 && (info[1] & (1 << 16)))
+            return stream_copy_avx512;
+        if (os_saves_avx && (info[1] & (1 << 5)))
+            return stream_copy_avx2;
+    }
+    return stream_copy_sse2;
+#else
+    // These also check that the OS saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return stream_copy_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return stream_copy_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return stream_copy_sse2;
+    return stream_copy_memcpy;
+#endif
+}
+
+#endif
+
+void stream_copy(void *destination, const void *source, size_t size)
+{
+#if defined(STREAM_COPY_X86)
+    static const StreamCopyKernel kernel = stream_copy_select_kernel(); // Thread-safe since C++11
+    kernel(static_cast<unsigned char *>(destination), static_cast<const unsigned char *>(source), size);
+#else
+    memcpy(destination, source, size);
+#endif
+}
+
+#endif
@@ -0,0 +1,215 @@
+/*
+    The virtual arena allocator is an arena allocator that grows in place instead of by chaining blocks.
+
+    Allocation is performed in amortized O(1) time.
+
+    On construction, a large range of virtual address space is reserved up front, but none of it is backed by
+    memory. As allocations advance past the committed part, more of the range is committed (in steps of
+    VIRTUAL_ARENA_COMMIT_SIZE, to keep the number of syscalls down). Address space is cheap on 64-bit
+    systems, so the reservation can be as large as the arena could ever need (many gigabytes) without costing
+    any memory.
+
+    Since the data never leaves one range, it's always contiguous, and pack() is a no-op: it just returns the
+    base of the range and the number of bytes used. Unlike ArenaAllocator::pack(), the returned pointer is
+    owned by the arena and is only valid until the arena is reset, freed or destroyed. Likewise, there are
+    no blocks to walk, allocate or hop between, which is where the arena allocator spends most of its
+    non-bump time.
+
+    As with the arena allocator, reset() keeps the committed memory around for reuse, while free() decommits
+    it, giving the memory back to the OS (but keeping the reservation). Allocations fail (returning nullptr)
+    only when the reservation is exhausted.
+
+    The range starts on a page boundary, so alloc_align() honors any alignment up to the page size.
+
+    Freshly committed pages are always zero, which alloc_zeroed() takes advantage of: it only clears the part
+    of an allocation below the dirty size, which reset() raises to the old offset and free() (having
+    decommitted everything) drops back to zero. For an arena that isn't freed between cycles, release_pages()
+    decommits just the pages past the offset, so the memory is both given back and clean when recommitted.
+*/
+
+#ifndef VIRTUAL_ARENA_ALLOC_H
+#define VIRTUAL_ARENA_ALLOC_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // Or windows.h defines min()/max() macros that break std::min()/std::max()
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+constexpr size_t VIRTUAL_ARENA_COMMIT_SIZE = 64 * 1024;
+constexpr size_t VIRTUAL_ARENA_PAGE_SIZE = 4096; // The smallest page size we run on, so the guaranteed alignment of the range
+
+class VirtualArenaAllocator
+{
+    private:
+        unsigned char *_base;
+        size_t _offset;
+        size_t _committed;
+        size_t _reserved;
+        size_t _dirty_size; // Committed memory is zero past this, except for what has been handed out since
+
+        bool commit(size_t size);
+        void decommit(size_t size);
+
+    public:
+        VirtualArenaAllocator(size_t reserve_size);
+        ~VirtualArenaAllocator();
+        void *alloc(size_t size);
+        void *alloc_align(size_t size, size_t alignment);
+        void *alloc_zeroed(size_t size);
+        void reset();
+        void free();
+        void release_pages();
+        void *pack(size_t *packed_size);
+};
+
+VirtualArenaAllocator::VirtualArenaAllocator(size_t reserve_size)
+{
+    _offset = 0;
+    _committed = 0;
+    _dirty_size = 0;
+    _reserved = (reserve_size + VIRTUAL_ARENA_COMMIT_SIZE - 1) & ~(VIRTUAL_ARENA_COMMIT_SIZE - 1);
+
+#if defined(_WIN32)
+    _base = static_cast<unsigned char *>(VirtualAlloc(nullptr, _reserved, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    void *mapping = mmap(nullptr, _reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    _base = mapping == MAP_FAILED ? nullptr : static_cast<unsigned char *>(mapping);
+#endif
+
+    if (!_base)
+        _reserved = 0; // Every allocation will fail
+}
+
+VirtualArenaAllocator::~VirtualArenaAllocator()
+{
+    if (!_base)
+        return;
+
+#if defined(_WIN32)
+    VirtualFree(_base, 0, MEM_RELEASE);
+#else
+    munmap(_base, _reserved);
+#endif
+}
+
+bool VirtualArenaAllocator::commit(size_t size)
+{
+    if (size > _reserved)
+        return false; // Reservation exhausted
+
+    size_t new_committed = (size + VIRTUAL_ARENA_COMMIT_SIZE - 1) & ~(VIRTUAL_ARENA_COMMIT_SIZE - 1);
+    if (new_committed > _reserved)
+        new_committed = _reserved;
+
+#if defined(_WIN32)
+    if (!VirtualAlloc(_base + _committed, new_committed - _committed, MEM_COMMIT, PAGE_READWRITE))
+        return false;
+#else
+    if (mprotect(_base + _committed, new_committed - _committed, PROT_READ | PROT_WRITE) != 0)
+        return false;
+#endif
+
+    _committed = new_committed;
+    return true;
+}
+
+void VirtualArenaAllocator::decommit(size_t size)
+{
+    // Decommits everything past size (a multiple of VIRTUAL_ARENA_COMMIT_SIZE)
+    if (size >= _committed)
+        return;
+
+#if defined(_WIN32)
+    VirtualFree(_base + size, _committed - size, MEM_DECOMMIT);
+#else
+    // Mapping fresh PROT_NONE pages over the range drops the old ones without giving up the reservation
+    mmap(_base + size, _committed - size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+    _committed = size;
+    _dirty_size = std::min(_dirty_size, size);
+}
+
+void *VirtualArenaAllocator::alloc(size_t size)
+{
+    constexpr size_t DEFAULT_ALIGNMENT = alignof(max_align_t);
+
+    size_t corrected_offset = (_offset + DEFAULT_ALIGNMENT - 1) & ~(DEFAULT_ALIGNMENT - 1);
+    if (corrected_offset > _committed || size > _committed - corrected_offset)
+    {
+        if (size > _reserved || !commit(corrected_offset + size))
+            return nullptr; // Out of space
+    }
+
+    _offset = corrected_offset + size;
+    return &_base[corrected_offset];
+}
+
+void *VirtualArenaAllocator::alloc_align(size_t size, size_t alignment)
+{
+    assert((alignment & (alignment - 1)) == 0); // Alignment must be a power of two
+    assert(alignment <= VIRTUAL_ARENA_PAGE_SIZE); // The range itself is only page-aligned
+
+    size_t corrected_offset = (_offset + alignment - 1) & ~(alignment - 1);
+    if (corrected_offset > _committed || size > _committed - corrected_offset)
+    {
+        if (size > _reserved || !commit(corrected_offset + size))
+            return nullptr; // Out of space
+    }
+
+    _offset = corrected_offset + size;
+    return &_base[corrected_offset];
+}
+
+void *VirtualArenaAllocator::alloc_zeroed(size_t size)
+{
+    unsigned char *memory = static_cast<unsigned char *>(alloc(size));
+    if (!memory)
+        return nullptr;
+
+    size_t start = memory - _base;
+    if (start < _dirty_size)
+        memset(memory, 0, std::min(size, _dirty_size - start));
+    return memory;
+}
+
+void VirtualArenaAllocator::reset()
+{
+    _dirty_size = std::max(_dirty_size, _offset);
+    _offset = 0;
+}
+
+void VirtualArenaAllocator::free()
+{
+    decommit(0);
+    _offset = 0;
+}
+
+void VirtualArenaAllocator::release_pages()
+{
+    _dirty_size = std::max(_dirty_size, _offset);
+    decommit((_offset + VIRTUAL_ARENA_COMMIT_SIZE - 1) & ~(VIRTUAL_ARENA_COMMIT_SIZE - 1));
+}
+
+void *VirtualArenaAllocator::pack(size_t *packed_size)
+{
+    if (_offset == 0)
+        return nullptr;
+
+    *packed_size = _offset;
+    return _base;
+}
+
+#endif